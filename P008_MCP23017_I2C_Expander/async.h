@@ -0,0 +1,84 @@
+/*--------------------------------------------------------------------------------------------------------------------------------------------------------
+ * Project: 		MCP23017 TWI Library
+ * Hardware:		Arduino UNO
+ * Micro:			ATMEGA328P
+ * IDE:				Atmel Studio 6.2
+ *
+ * Name:    		async.h
+ * Purpose: 		Stackless coroutines (protothreads) for the cooperative main loop
+ * Date:			19-10-2026
+ * Author:			Marcel van der Ven
+ *
+ * Hardware setup:	
+ *
+ * Note(s):			A task is a function which is called from the main loop over and over again,
+ *					it returns ASYNC_WAITING while it waits for a bus transaction and ASYNC_DONE
+ *					when it is finished. The resume point is stored in an AsyncContext (2 bytes),
+ *					there is no stack per task and no heap. Local variables do not survive a
+ *					yield, keep the state (and the TwiRequest and its buffer) in a structure of
+ *					the task. Do not use switch statements inside a task.
+ *
+ *					Example, read GPIOB without blocking the main loop:
+ *
+ *						struct ButtonTask { AsyncContext context; struct TwiRequest request; BYTE value; };
+ *
+ *						BYTE ButtonTaskRun(struct ButtonTask* task)
+ *						{
+ *							ASYNC_BEGIN(&task->context);
+ *							ASYNC_WAIT_UNTIL(&task->context, ReadIoExpanderRegisterAsync(&mcp23017, &task->request, MCP23017_GPIOB, &task->value));
+ *							ASYNC_AWAIT(&task->context, &task->request);
+ *							... use task->value ...
+ *							ASYNC_END(&task->context);
+ *						}
+ *
+ *					While the task waits the main loop runs the other tasks, a register read
+ *					keeps the bus busy for about 90 us at 400 kHz (360 us at 100 kHz) of which
+ *					the CPU only spends a few microseconds per byte in the TWI interrupt.
+ *--------------------------------------------------------------------------------------------------------------------------------------------------------*/
+
+
+#ifndef ASYNC_H_
+#define ASYNC_H_
+
+
+#include "common.h"
+#include "twi.h"
+
+/************************************************************************/
+/* Defines													   */
+/************************************************************************/
+
+/* Return values of a task */
+#define ASYNC_WAITING				0
+#define ASYNC_DONE					1
+
+
+/************************************************************************/
+/* Type Definitions			                                            */
+/************************************************************************/
+
+/* Resume point of a task, 0 is the start. Clear it to restart the task. */
+typedef uint16_t AsyncContext;
+
+
+/************************************************************************/
+/* Macros				                                                */
+/************************************************************************/
+#define ASYNC_INIT(context)						(*(context) = 0)
+
+#define ASYNC_BEGIN(context)					switch(*(context)) { case 0:
+
+#define ASYNC_END(context)						} *(context) = 0; return ASYNC_DONE
+
+/* Returns to the main loop until the condition is true, the condition is evaluated on every call */
+#define ASYNC_WAIT_UNTIL(context, condition)	do { *(context) = __LINE__; case __LINE__: \
+												if(!(condition)) { return ASYNC_WAITING; } } while(0)
+
+/* Gives the other tasks one turn */
+#define ASYNC_YIELD(context)					do { *(context) = __LINE__; return ASYNC_WAITING; case __LINE__:; } while(0)
+
+/* Waits until a submitted request (not a chain) is finished, the status is in request->status */
+#define ASYNC_AWAIT(context, request)			ASYNC_WAIT_UNTIL(context, (request)->status != TWI_STATUS_PENDING)
+
+
+#endif /* ASYNC_H_ */
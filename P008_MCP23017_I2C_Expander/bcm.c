@@ -0,0 +1,225 @@
+/*--------------------------------------------------------------------------------------------------------------------------------------------------------
+ * Project:			MCP23017 TWI Library
+ * Hardware:		Arduino UNO
+ * Micro:			ATMEGA328P
+ * IDE:				Atmel Studio 6.2
+ *
+ * Name:    		bcm.c
+ * Purpose: 		LED dimming of the 16 outputs with binary code modulation
+ * Date:			19-10-2026
+ * Version:			1.0
+ * Author:			Marcel van der Ven
+ *
+ *
+ * Note(s):			See bcm.h
+ *--------------------------------------------------------------------------------------------------------------------------------------------------------*/
+
+/************************************************************************/
+/* Includes
+/************************************************************************/
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include "string.h"
+#include "bcm.h"
+#include "twi.h"
+
+
+/************************************************************************/
+/* Variables
+/************************************************************************/
+
+/* Brightness set by BcmSetBrightness(), used by the next BcmCommit() */
+static BYTE brightness[BCM_CHANNELS];
+
+/* Double buffered OLATA/OLATB value per plane */
+static BYTE planes[2][BCM_BITS][2];
+static volatile BYTE activeBuffer;
+static volatile BOOL swapPending;
+
+/* Plane which is written at the next compare match */
+static BYTE plane;
+static struct MCP23017* bcmDevice;
+static struct TwiRequest request;
+static struct TwiRequest requestB;
+static volatile uint16_t missedPlanes;
+
+
+/************************************************************************/
+/* Functions
+/************************************************************************/
+
+/***************************************************************************
+*  Function:		BcmInitialize(struct MCP23017* device)
+*  Description:		Starts the engine with all channels off, all pins become outputs.
+*					Works in both banks. Requires TimerInitialize().
+*  Receives:		struct MCP23017* device		:	The IO Expander with the LEDs.
+*  Returns:			Nothing
+***************************************************************************/
+void BcmInitialize(struct MCP23017* device)
+{
+	WriteIoExpanderRegister(device, MCP23017_OLATA, 0x00);
+	WriteIoExpanderRegister(device, MCP23017_OLATB, 0x00);
+	WriteIoExpanderRegister(device, MCP23017_IODIRA, 0x00);
+	WriteIoExpanderRegister(device, MCP23017_IODIRB, 0x00);
+
+	memset(brightness, 0, sizeof(brightness));
+	memset(planes, 0, sizeof(planes));
+	activeBuffer = 0;
+	swapPending = FALSE;
+	plane = 0;
+	missedPlanes = 0;
+	bcmDevice = device;
+
+	/* OLATA and OLATB, the register addresses follow the bank at every plane */
+	request = (struct TwiRequest){ .address = device->address, .flags = TWI_WRITE, .statisticsClass = MCP23017_CLASS_OLAT,
+								   .mux = device->mux, .channel = device->channel, .priority = TWI_PRIORITY_OUTPUT };
+	requestB = request;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		OCR1A = TCNT1 + BCM_BASE_TICKS;
+		TIFR1 = (1 << OCF1A);
+		TIMSK1 |= (1 << OCIE1A);
+	}
+}
+
+/***************************************************************************
+*  Function:		BcmStop()
+*  Description:		Stops the engine, the outputs keep the last written plane.
+*  Receives:		Nothing
+*  Returns:			Nothing
+***************************************************************************/
+void BcmStop(void)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		TIMSK1 &= ~(1 << OCIE1A);
+	}
+}
+
+/***************************************************************************
+*  Function:		BcmSetBrightness(BYTE channel, BYTE value)
+*  Description:		Sets the brightness of a channel, it becomes visible after BcmCommit().
+*  Receives:		BYTE channel		:	The channel (0-15).
+*					BYTE value			:	The brightness, 0 is off and (1 << BCM_BITS) - 1
+*											is fully on.
+*  Returns:			Nothing
+***************************************************************************/
+void BcmSetBrightness(BYTE channel, BYTE value)
+{
+	brightness[channel] = value;
+}
+
+/***************************************************************************
+*  Function:		BcmCommit()
+*  Description:		Calculates the planes of the set brightness in the unused buffer,
+*					the buffers are swapped at the start of the next frame without a
+*					pending OLAT write.
+*  Receives:		Nothing
+*  Returns:			Nothing
+***************************************************************************/
+void BcmCommit(void)
+{
+	BYTE (*buffer)[2];
+	BYTE channel;
+	BYTE bit;
+
+	/* The interrupt must not swap while the buffer is being filled */
+	swapPending = FALSE;
+	buffer = planes[activeBuffer ^ 1];
+	memset(buffer, 0, sizeof(planes[0]));
+
+	for(channel = 0; channel < BCM_CHANNELS; channel++)
+	{
+		for(bit = 0; bit < BCM_BITS; bit++)
+		{
+			if(brightness[channel] & (1 << bit))
+			{
+				buffer[bit][channel >> 3] |= (1 << (channel & 0x07));
+			}
+		}
+	}
+
+	swapPending = TRUE;
+}
+
+/***************************************************************************
+*  Function:		uint16_t BcmGetMissedPlanes()
+*  Description:		Returns the number of planes which could not be written because the
+*					previous write was still waiting for the bus or the TWI queue was
+*					full, the outputs then keep the previous plane.
+*  Receives:		Nothing
+*  Returns:			The number of missed planes.
+***************************************************************************/
+uint16_t BcmGetMissedPlanes(void)
+{
+	uint16_t missed;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		missed = missedPlanes;
+	}
+
+	return missed;
+}
+
+/***************************************************************************
+*  Function:		ISR(TIMER1_COMPA_vect)
+*  Description:		Start of a plane, queues the OLAT write and schedules the next plane.
+*					The buffers are swapped at plane 0 when no write is pending.
+*					In BANK0 OLATA and OLATB are adjacent and written with one request
+*					(in sequential and in byte mode), in BANK1 two requests are chained.
+*  Receives:		Nothing
+*  Returns:			Nothing
+***************************************************************************/
+ISR(TIMER1_COMPA_vect)
+{
+	BOOL busy;
+
+	OCR1A += (uint16_t)BCM_BASE_TICKS << plane;
+
+	busy = (request.status == TWI_STATUS_PENDING || requestB.status == TWI_STATUS_PENDING);
+
+	/* A pending write still reads the active buffer, the swap then waits for the next frame */
+	if(plane == 0 && swapPending && !busy)
+	{
+		activeBuffer ^= 1;
+		swapPending = FALSE;
+	}
+
+	if(busy)
+	{
+		missedPlanes++;
+	}
+	else
+	{
+		request.reg = MCP23017_REGISTER(bcmDevice->bank, MCP23017_INDEX_OLAT, MCP23017_PORTA);
+		request.buffer = planes[activeBuffer][plane];
+
+		if(bcmDevice->bank == BANK0)
+		{
+			request.length = 2;
+			request.next = NULL;
+		}
+		else
+		{
+			request.length = 1;
+			request.next = &requestB;
+			requestB.reg = MCP23017_REGISTER_BANK1(MCP23017_INDEX_OLAT, MCP23017_PORTB);
+			requestB.buffer = &planes[activeBuffer][plane][MCP23017_PORTB];
+			requestB.length = 1;
+		}
+
+		/* Queue full: the outputs keep the previous plane */
+		if(!TwiSubmit(&request))
+		{
+			missedPlanes++;
+		}
+	}
+
+	if(++plane == BCM_BITS)
+	{
+		plane = 0;
+	}
+}
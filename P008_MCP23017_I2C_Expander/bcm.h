@@ -0,0 +1,55 @@
+/*--------------------------------------------------------------------------------------------------------------------------------------------------------
+ * Project: 		MCP23017 TWI Library
+ * Hardware:		Arduino UNO
+ * Micro:			ATMEGA328P
+ * IDE:				Atmel Studio 6.2
+ *
+ * Name:    		bcm.h
+ * Purpose: 		LED dimming of the 16 outputs with binary code modulation
+ * Date:			19-10-2026
+ * Author:			Marcel van der Ven
+ *
+ * Hardware setup:	LEDs on the outputs of PORTA and PORTB.
+ *
+ * Note(s):			Binary code modulation shows bit k of every brightness for BCM_BASE_TICKS << k
+ *					timer ticks. For every bit (plane) the OLATA/OLATB pair is precomputed, so a frame
+ *					is BCM_BITS writes of 2 bytes, independent of the number of channels. The planes
+ *					are paced by compare unit A of the Timer1 timebase.
+ *
+ *					The shortest plane must be longer than one OLAT write (about 100 us at 400 kHz).
+ *					With the default 128 us base an 8-bit frame takes 32.6 ms (31 Hz, visible flicker
+ *					on moving LEDs), 6 bits give 8.1 ms (123 Hz). The bus load is BCM_BITS writes of
+ *					about 90 us per frame: 2.2% with 8 bits, 6.7% with 6 bits.
+ *
+ *					The brightness is double buffered, BcmCommit() calculates the planes in the
+ *					unused buffer and the buffers are swapped at the start of a frame, so a change
+ *					never shows half a frame. While the engine runs it owns OLATA and OLATB.
+ *--------------------------------------------------------------------------------------------------------------------------------------------------------*/
+
+
+#ifndef BCM_H_
+#define BCM_H_
+
+
+#include "common.h"
+#include "mcp23017.h"
+
+/************************************************************************/
+/* Defines													   */
+/************************************************************************/
+#define BCM_CHANNELS				16		/* Channel 0-7: PORTA pin 0-7, channel 8-15: PORTB pin 0-7 */
+#define BCM_BITS					8		/* Brightness resolution */
+#define BCM_BASE_TICKS				256		/* Duration of the least significant plane (128 us) */
+
+
+/************************************************************************/
+/* API					                                                */
+/************************************************************************/
+void BcmInitialize(struct MCP23017* device);
+void BcmStop(void);
+void BcmSetBrightness(BYTE channel, BYTE value);
+void BcmCommit(void);
+uint16_t BcmGetMissedPlanes(void);
+
+
+#endif /* BCM_H_ */
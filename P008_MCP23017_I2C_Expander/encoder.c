@@ -0,0 +1,147 @@
+/*--------------------------------------------------------------------------------------------------------------------------------------------------------
+ * Project:			MCP23017 TWI Library
+ * Hardware:		Arduino UNO
+ * Micro:			ATMEGA328P
+ * IDE:				Atmel Studio 6.2
+ *
+ * Name:    		encoder.c
+ * Purpose: 		Quadrature (rotary) encoder decoding from the interrupt events of a MCP23017
+ * Date:			19-10-2026
+ * Version:			1.0
+ * Author:			Marcel van der Ven
+ *
+ *
+ * Note(s):			See encoder.h
+ *--------------------------------------------------------------------------------------------------------------------------------------------------------*/
+
+/************************************************************************/
+/* Defines
+/************************************************************************/
+
+/* Pin A of every pair */
+#define PIN_A_MASK		0x5555
+
+
+/************************************************************************/
+/* Includes
+/************************************************************************/
+#include "string.h"
+#include "encoder.h"
+
+
+/************************************************************************/
+/* Variables
+/************************************************************************/
+
+/* Count change indexed by (previous BA << 2) | current BA, forward is 00 -> 01 -> 11 -> 10 -> 00 */
+/* Both pins changed is invalid (a missed transition) and does not count */
+static const int8_t transitions[16] =
+{
+	 0, +1, -1,  0,
+	-1,  0,  0, +1,
+	+1,  0,  0, -1,
+	 0, -1, +1,  0
+};
+
+
+/************************************************************************/
+/* Functions
+/************************************************************************/
+
+/***************************************************************************
+*  Function:		EncoderInitialize(struct Encoders* encoders, struct MCP23017* device, BYTE encoderMask)
+*  Description:		Configures the pins of the encoders as inputs with pull-up and
+*					interrupt-on-change against the previous value, and reads the start
+*					position. The device is switched to BANK0 so an event holds both ports.
+*  Receives:		struct Encoders* encoders	:	The encoders.
+*					struct MCP23017* device		:	The IO Expander.
+*					BYTE encoderMask			:	Bit n set when encoder n is connected.
+*  Returns:			Nothing
+***************************************************************************/
+void EncoderInitialize(struct Encoders* encoders, struct MCP23017* device, BYTE encoderMask)
+{
+	MCP23017_Port port;
+	BYTE pins;
+	BYTE i;
+
+	memset(encoders, 0, sizeof(*encoders));
+	encoders->device = device;
+
+	for(i = 0; i < ENCODER_COUNT; i++)
+	{
+		if(encoderMask & (1 << i))
+		{
+			encoders->pins |= (uint16_t)0x03 << (i << 1);
+		}
+	}
+
+	SwitchBank(device, BANK0);
+
+	for(port = MCP23017_PORTA; port <= MCP23017_PORTB; port++)
+	{
+		pins = (BYTE)(encoders->pins >> (port << 3));
+
+		WriteIoExpanderRegister(device, MCP23017_IODIRA + port, device->shadow.iodir[port] | pins);
+		WriteIoExpanderRegister(device, MCP23017_GPPUA + port, device->shadow.gppu[port] | pins);
+		WriteIoExpanderRegister(device, MCP23017_INTCONA + port, device->shadow.intcon[port] & ~pins);
+		WriteIoExpanderRegister(device, MCP23017_GPINTENA + port, device->shadow.gpinten[port] | pins);
+
+		encoders->previous |= (uint16_t)ReadIoExpanderRegister(device, MCP23017_GPIOA + port) << (port << 3);
+	}
+}
+
+/***************************************************************************
+*  Function:		EncoderProcessEvent(struct Encoders* encoders, const struct MCP23017Event* event)
+*  Description:		Decodes an interrupt event (from DrainEvents()), events of other devices
+*					are ignored. The changed and invalid pairs of all encoders are found
+*					with a few word operations, only encoders which moved are decoded.
+*  Receives:		struct Encoders* encoders			:	The encoders.
+*					const struct MCP23017Event* event	:	The event.
+*  Returns:			Nothing
+***************************************************************************/
+void EncoderProcessEvent(struct Encoders* encoders, const struct MCP23017Event* event)
+{
+	uint16_t current = encoders->previous;
+	uint16_t changed;
+	uint16_t moved;
+	uint16_t invalid;
+	BYTE i;
+	BYTE shift;
+
+	if(event->device != encoders->device)
+	{
+		return;
+	}
+
+	/* INTCAP only holds a new capture for the port which interrupted */
+	if(event->intf[MCP23017_PORTA])
+	{
+		current = (current & 0xFF00) | event->intcap[MCP23017_PORTA];
+	}
+
+	if(event->intf[MCP23017_PORTB])
+	{
+		current = (current & 0x00FF) | ((uint16_t)event->intcap[MCP23017_PORTB] << 8);
+	}
+
+	/* Per pair on the A bit: the pair changed, both pins changed */
+	changed = (current ^ encoders->previous) & encoders->pins;
+	moved = (changed | (changed >> 1)) & PIN_A_MASK;
+	invalid = changed & (changed >> 1) & PIN_A_MASK;
+
+	for(i = 0; moved != 0; i++, moved >>= 2, invalid >>= 2)
+	{
+		if(moved & 0x01)
+		{
+			shift = i << 1;
+			encoders->counts[i] += transitions[(((encoders->previous >> shift) & 0x03) << 2) | ((current >> shift) & 0x03)];
+
+			if(invalid & 0x01)
+			{
+				encoders->missedSteps[i]++;
+			}
+		}
+	}
+
+	encoders->previous = current;
+}
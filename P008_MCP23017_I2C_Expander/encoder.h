@@ -0,0 +1,61 @@
+/*--------------------------------------------------------------------------------------------------------------------------------------------------------
+ * Project: 		MCP23017 TWI Library
+ * Hardware:		Arduino UNO
+ * Micro:			ATMEGA328P
+ * IDE:				Atmel Studio 6.2
+ *
+ * Name:    		encoder.h
+ * Purpose: 		Quadrature (rotary) encoder decoding from the interrupt events of a MCP23017
+ * Date:			19-10-2026
+ * Author:			Marcel van der Ven
+ *
+ * Hardware setup:	Encoder n on pin pair 2n (A) and 2n+1 (B) of the 16 pins, PORTA pin 0-7 are
+ *					pins 0-7 and PORTB pin 0-7 are pins 8-15, so up to 8 encoders per device.
+ *
+ * Note(s):			Every transition of an encoder pin generates an interrupt, the INTF/INTCAP read
+ *					is a chain of two register reads and takes 10 bytes on the bus (about 230 us at
+ *					400 kHz). A second transition within that time is not captured, it shows up as
+ *					both pins of the pair changed and is counted as a missed step. The sustainable
+ *					rate is therefore ENCODER_MAX_TRANSITIONS per second for all encoders of a device
+ *					together: about 4400 transitions/s at 400 kHz, or 1100 full quadrature cycles/s.
+ *					More than one missed transition in a row can not always be detected.
+ *--------------------------------------------------------------------------------------------------------------------------------------------------------*/
+
+
+#ifndef ENCODER_H_
+#define ENCODER_H_
+
+
+#include "common.h"
+#include "mcp23017.h"
+
+/************************************************************************/
+/* Defines													   */
+/************************************************************************/
+#define ENCODER_COUNT				8
+
+/* Maximum transitions per second, one INTF/INTCAP read (10 bytes of 9 clocks) per transition */
+#define ENCODER_MAX_TRANSITIONS		(TWI_FREQUENCY / (10 * 9))
+
+
+/************************************************************************/
+/* Structures												   */
+/************************************************************************/
+struct Encoders
+{
+	struct MCP23017* device;
+	uint16_t pins;							/* Pins of the encoders in use */
+	uint16_t previous;						/* Last known level of the pins */
+	int16_t counts[ENCODER_COUNT];			/* Signed position, one count per transition */
+	uint16_t missedSteps[ENCODER_COUNT];	/* Transitions where both pins changed */
+};
+
+
+/************************************************************************/
+/* API					                                                */
+/************************************************************************/
+void EncoderInitialize(struct Encoders* encoders, struct MCP23017* device, BYTE encoderMask);
+void EncoderProcessEvent(struct Encoders* encoders, const struct MCP23017Event* event);
+
+
+#endif /* ENCODER_H_ */
@@ -0,0 +1,138 @@
+/*--------------------------------------------------------------------------------------------------------------------------------------------------------
+ * Project:			MCP23017 TWI Library
+ * Hardware:		Arduino UNO
+ * Micro:			ATMEGA328P
+ * IDE:				Atmel Studio 6.2
+ *
+ * Name:    		keypad.c
+ * Purpose: 		8x8 key matrix scanning with a MCP23017
+ * Date:			19-10-2026
+ * Version:			1.0
+ * Author:			Marcel van der Ven
+ *
+ *
+ * Note(s):			See keypad.h
+ *--------------------------------------------------------------------------------------------------------------------------------------------------------*/
+
+/************************************************************************/
+/* Includes
+/************************************************************************/
+#include "keypad.h"
+#include "twi.h"
+
+
+/************************************************************************/
+/* Functions
+/************************************************************************/
+
+/***************************************************************************
+*  Function:		KeypadInitialize(struct Keypad* keypad, struct MCP23017* device)
+*  Description:		Configures the IO Expander for matrix scanning: PORTA output latch
+*					0 and all columns pulled low (IODIRA 0), PORTB inputs with pull-ups
+*					and inverted polarity so a pressed key reads as a set bit.
+*  Receives:		struct Keypad* keypad		:	The keypad.
+*					struct MCP23017* device		:	The IO Expander of the matrix.
+*  Returns:			Nothing
+***************************************************************************/
+void KeypadInitialize(struct Keypad* keypad, struct MCP23017* device)
+{
+	keypad->device = device;
+	keypad->keys.bitmap = 0;
+
+	WriteIoExpanderRegister(device, MCP23017_OLATA, 0x00);
+	WriteIoExpanderRegister(device, MCP23017_IODIRA, 0x00);
+	WriteIoExpanderRegister(device, MCP23017_IODIRB, 0xFF);
+	WriteIoExpanderRegister(device, MCP23017_GPPUB, 0xFF);
+	WriteIoExpanderRegister(device, MCP23017_IPOLB, 0xFF);
+}
+
+/***************************************************************************
+*  Function:		BYTE KeypadScan(struct Keypad* keypad, struct KeypadEdge* edges, BYTE maxEdges)
+*  Description:		Scans the matrix and reports the keys which changed. First all
+*					columns are pulled low and the rows are read, when no key is
+*					pressed now or before the scan ends there. Otherwise every column
+*					is pulled low in turn (the others are inputs) and its rows are read,
+*					all in one chained transaction. Afterwards all columns are pulled
+*					low again so a key press can be detected with the next quick check.
+*  Receives:		struct Keypad* keypad			:	The keypad.
+*					struct KeypadEdge* edges		:	Receives the keys which changed.
+*					BYTE maxEdges					:	Room in edges, further changes are
+*														reported by the next scan.
+*  Returns:			The number of edges.
+***************************************************************************/
+BYTE KeypadScan(struct Keypad* keypad, struct KeypadEdge* edges, BYTE maxEdges)
+{
+	/* IODIRA per column, a cleared bit pulls the column low through the 0 in OLATA */
+	static const BYTE columnPatterns[KEYPAD_COLUMNS + 1] = { 0xFE, 0xFD, 0xFB, 0xF7, 0xEF, 0xDF, 0xBF, 0x7F, 0x00 };
+	struct TwiRequest requests[2 * KEYPAD_COLUMNS + 1];
+	BYTE rows[KEYPAD_COLUMNS];
+	BYTE address = keypad->device->address;
+	struct TwiMux* mux = keypad->device->mux;
+	BYTE channel = keypad->device->channel;
+	BYTE columnRegister = MCP23017_REGISTER(keypad->device->bank, MCP23017_INDEX_IODIR, MCP23017_PORTA);
+	BYTE rowRegister = MCP23017_REGISTER(keypad->device->bank, MCP23017_INDEX_GPIO, MCP23017_PORTB);
+	BYTE edgeCount = 0;
+	BYTE column;
+	BYTE row;
+	BYTE changed;
+	BYTE i;
+
+	/* Quick check: all columns low (the state after a scan), read the rows */
+	requests[0] = (struct TwiRequest){ .address = address, .mux = mux, .channel = channel, .priority = TWI_PRIORITY_SCAN, .reg = columnRegister, .flags = TWI_WRITE, .length = 1,
+									   .buffer = (BYTE*)&columnPatterns[KEYPAD_COLUMNS], .statisticsClass = MCP23017_CLASS_BURST,
+									   .next = &requests[1] };
+	requests[1] = (struct TwiRequest){ .address = address, .mux = mux, .channel = channel, .priority = TWI_PRIORITY_SCAN, .reg = rowRegister, .flags = TWI_READ, .length = 1,
+									   .buffer = &rows[0], .statisticsClass = MCP23017_CLASS_BURST };
+
+	if(TwiTransfer(&requests[0]) != TWI_STATUS_DONE || (rows[0] == 0 && keypad->keys.bitmap == 0))
+	{
+		return 0;
+	}
+
+	/* Full scan: one column low, read the rows */
+	for(column = 0; column < KEYPAD_COLUMNS; column++)
+	{
+		i = column << 1;
+		requests[i] = (struct TwiRequest){ .address = address, .mux = mux, .channel = channel, .priority = TWI_PRIORITY_SCAN, .reg = columnRegister, .flags = TWI_WRITE, .length = 1,
+										   .buffer = (BYTE*)&columnPatterns[column], .statisticsClass = MCP23017_CLASS_BURST,
+										   .next = &requests[i + 1] };
+		requests[i + 1] = (struct TwiRequest){ .address = address, .mux = mux, .channel = channel, .priority = TWI_PRIORITY_SCAN, .reg = rowRegister, .flags = TWI_READ, .length = 1,
+											   .buffer = &rows[column], .statisticsClass = MCP23017_CLASS_BURST,
+											   .next = &requests[i + 2] };
+	}
+
+	/* Leave all columns low */
+	requests[2 * KEYPAD_COLUMNS] = (struct TwiRequest){ .address = address, .mux = mux, .channel = channel, .priority = TWI_PRIORITY_SCAN, .reg = columnRegister, .flags = TWI_WRITE, .length = 1,
+														.buffer = (BYTE*)&columnPatterns[KEYPAD_COLUMNS],
+														.statisticsClass = MCP23017_CLASS_BURST };
+
+	if(TwiTransfer(&requests[0]) != TWI_STATUS_DONE)
+	{
+		return 0;
+	}
+
+	/* Edges, one column (byte) at a time */
+	for(column = 0; column < KEYPAD_COLUMNS; column++)
+	{
+		changed = rows[column] ^ keypad->keys.columns[column];
+
+		for(row = 0; row < KEYPAD_ROWS && changed != 0; row++, changed >>= 1)
+		{
+			if(changed & 0x01)
+			{
+				if(edgeCount == maxEdges)
+				{
+					return edgeCount;
+				}
+
+				edges[edgeCount].key = KEYPAD_KEY(column, row);
+				edges[edgeCount].pressed = (rows[column] >> row) & 0x01;
+				edgeCount++;
+
+				keypad->keys.columns[column] ^= (1 << row);
+			}
+		}
+	}
+
+	return edgeCount;
+}
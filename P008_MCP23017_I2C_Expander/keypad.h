@@ -0,0 +1,75 @@
+/*--------------------------------------------------------------------------------------------------------------------------------------------------------
+ * Project: 		MCP23017 TWI Library
+ * Hardware:		Arduino UNO
+ * Micro:			ATMEGA328P
+ * IDE:				Atmel Studio 6.2
+ *
+ * Name:    		keypad.h
+ * Purpose: 		8x8 key matrix scanning with a MCP23017
+ * Date:			19-10-2026
+ * Author:			Marcel van der Ven
+ *
+ * Hardware setup:	Columns on PORTA (pulled low one at a time), rows on PORTB (internal pull-ups).
+ *
+ * Note(s):			The columns are emulated open-drain outputs: the output latch (OLATA) stays 0
+ *					and a column is selected by clearing its IODIRA bit, the other columns are
+ *					inputs. Two pressed keys in the same row therefore never short a high column
+ *					to a low one. Every request sends its register address, so the scan works in
+ *					both banks and with and without sequential operation. The complete matrix is
+ *					scanned in one chained transaction (one START, one STOP): 59 bytes, about
+ *					1.3 ms at 400 kHz, instead of 16 separate transactions (56 bytes plus 16
+ *					STOP/START and driver round trips). When no key is pressed (the common case)
+ *					a scan is a single write/read pair of 7 bytes (about 0.16 ms).
+ *--------------------------------------------------------------------------------------------------------------------------------------------------------*/
+
+
+#ifndef KEYPAD_H_
+#define KEYPAD_H_
+
+
+#include "common.h"
+#include "mcp23017.h"
+
+/************************************************************************/
+/* Defines													   */
+/************************************************************************/
+#define KEYPAD_COLUMNS				8
+#define KEYPAD_ROWS					8
+
+/* Key number of a column and row */
+#define KEYPAD_KEY(column, row)		(((column) << 3) | (row))
+
+
+/************************************************************************/
+/* Structures												   */
+/************************************************************************/
+
+/* A key which was pressed or released */
+struct KeypadEdge
+{
+	BYTE key;								/* KEYPAD_KEY(column, row) */
+	BOOL pressed;							/* TRUE when pressed, FALSE when released */
+};
+
+struct Keypad
+{
+	struct MCP23017* device;
+
+	/* Key state, bit KEYPAD_KEY(column, row) is set when the key is pressed. */
+	/* columns[c] holds the rows of column c (little-endian, same bits as bitmap). */
+	union
+	{
+		uint64_t bitmap;
+		BYTE columns[KEYPAD_COLUMNS];
+	} keys;
+};
+
+
+/************************************************************************/
+/* API					                                                */
+/************************************************************************/
+void KeypadInitialize(struct Keypad* keypad, struct MCP23017* device);
+BYTE KeypadScan(struct Keypad* keypad, struct KeypadEdge* edges, BYTE maxEdges);
+
+
+#endif /* KEYPAD_H_ */
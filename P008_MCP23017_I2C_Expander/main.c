@@ -17,15 +17,21 @@
 /* Defines				                                                */
 /************************************************************************/
 #define F_CPU							16000000UL
-#define IO_EXPANDER_ADDRESS_7BIT		0x20		/* 7-bit address */
+#define IO_EXPANDER_ADDRESS_7BIT		0x20		/* 7-bit address, used when discovery finds no IO Expander */
 
 /************************************************************************/
 /* Includes				                                                */
 /************************************************************************/
 #include <avr/io.h>
+#include <avr/interrupt.h>
 #include "util/delay.h"
 #include "common.h"
 #include "mcp23017.h"
+#include "twi.h"
+#include "timer.h"
+#include "scanner.h"
+#include "selftest.h"
+#include "power.h"
 
 /***************************************************************************
 *  Function:		Setup()
@@ -35,14 +41,25 @@
 ***************************************************************************/
 void Setup()
 {
-	 /* Setup TWI (I2C) */
+	 /* Setup TWI (I2C), the transactions are executed by the TWI interrupt */
+	 TwiInitialize();
 	 
+	 /* Timestamps for the interrupt events */
+	 TimerInitialize();
 	 
+	 /* Unused peripherals off, the main loop sleeps between the events */
+	 PowerInitialize();
 	 
 	 /* Setup the two interrupt lines coming from the IO Expander */
 	 /* These are connected to PORTB0 (for interrupt on PORTA) and PORTB1 (for an interrupt on PORTB) */
 	 /* We set all pins of DDRB as input. */
 	 DDRB = 0x00;
+	 
+	 /* Both lines generate a pin change interrupt */
+	 PCMSK0 = (1 << PCINT0) | (1 << PCINT1);
+	 PCICR = (1 << PCIE0);
+	 
+	 sei();
 }
 
 /***************************************************************************
@@ -54,39 +71,57 @@ void Setup()
 ***************************************************************************/
 void SetupIoExpander()
 {
-	/* Initialize the IO Expander */
-	InitializeIoExpander(IO_EXPANDER_ADDRESS_7BIT, BANK0);
-	
-	/* Set pin 1 of PORTA and PORTB of the IO Expander as output (output = 0) */
-	/* And the rest of the pins as input */
-	SetPortDirectionReg(MCP23017_PORTA, 0xFE);
-	SetPortDirectionReg(MCP23017_PORTB, 0xFE);
+	/* Pin 0 of PORTA and PORTB is an output, the rest are inputs */
+	/* The two pushbuttons are connected to pin 1 of PORTA and PORTB, they pull the line low when pressed. */
+	/* They use the pull-up and generate an interrupt when the pin differs from DEFVAL (1). */
+	/* IOCON: default bank and the INTPOL bit, so the interrupt for PORTA and PORTB is high-active */
+	static const BYTE inputProfile[MCP23017_PROFILE_LENGTH] = MCP23017_INPUT_PROFILE(MCP23017_INTPOL,
+		(MCP23017_PROFILE_OUTPUT, MCP23017_PROFILE_BUTTON_PRESS, MCP23017_PROFILE_INPUT, MCP23017_PROFILE_INPUT,
+		 MCP23017_PROFILE_INPUT, MCP23017_PROFILE_INPUT, MCP23017_PROFILE_INPUT, MCP23017_PROFILE_INPUT),
+		(MCP23017_PROFILE_OUTPUT, MCP23017_PROFILE_BUTTON_PRESS, MCP23017_PROFILE_INPUT, MCP23017_PROFILE_INPUT,
+		 MCP23017_PROFILE_INPUT, MCP23017_PROFILE_INPUT, MCP23017_PROFILE_INPUT, MCP23017_PROFILE_INPUT));
+	BYTE address = IO_EXPANDER_ADDRESS_7BIT;
+	BYTE found = ScannerDiscover(NULL, 0);
 	
-	/* For the two pushbutton-inputs enable the interrupt on change feature */
-	/* The two pushbuttons are connected to pin 1 of PORTA and PORTB */
-	SetIntOnChangeReg(MCP23017_PORTA, 0x02);
-	SetIntOnChangeReg(MCP23017_PORTB, 0x02);
+	/* Use the IO Expander with the lowest address that responds */
+	if(found != 0)
+	{
+		address = MCP23017_ADDRESS_FIRST;
+		while(!(found & 0x01))
+		{
+			found >>= 1;
+			address++;
+		}
+	}
 	
-	/* The pushbuttons will pull the line low when pressed, */
-	/* so set the bit 1 in DEFVAL register for each port */
-	/* The DEFVAL register contains the compare value of the pin, if the value of the pin is */
-	/* different then in the DEFVAL register a interrupt is generated. */
-	SetDefaultCompareReg(MCP23017_PORTA, 0x02);
-	SetDefaultCompareReg(MCP23017_PORTB, 0x02);
+	/* Initialize the IO Expander */
+	InitializeIoExpander(address, BANK0);
 	
-	/* Configure when the interrupt is generated */
-	/* We have set DefaultCompare register so we generate the interrupt when the pin' value is not */
-	/* equal to the value in the Default Compare register */
-	SetIntControlReg(MCP23017_PORTA, 0x02);
-	SetIntControlReg(MCP23017_PORTB, 0x02);
+	/* Direction, polarity, interrupt-on-change, compare value and mode, IOCON and pull-ups in one burst */
+	ApplyInputProfile(&mcp23017, inputProfile);
 	
-	/* Set the configuration of the chip, we use the default bank and we set the INTPOL bit */
-	/* So the interrupt for PORTA and PORTB is high-active */
-	SetIoConfigReg(MCP23017_PORTA, 0x01);
+	/* INTA on PORTB0 and INTB on PORTB1, a line still active after the read is read again */
+	AttachInterruptPins(&mcp23017, &PINB, (1 << PINB0), (1 << PINB1));
+}
+
+/***************************************************************************
+*  Function:		ISR(PCINT0_vect)
+*  Description:		Pin change of the IO Expander's interrupt lines, the interrupt
+*					lines are active-high (INTPOL) and stay high until INTCAP is read.
+*  Receives:		Nothing
+*  Returns:			Nothing
+***************************************************************************/
+ISR(PCINT0_vect)
+{
+	if(PINB & (1 << PINB0))
+	{
+		IoExpanderInterrupt(&mcp23017, MCP23017_PORTA);
+	}
 	
-	/* Set the pull-up resistors for the two pushbutton-inputs */
-	SetPullupConfigReg(MCP23017_PORTA, 0x02);
-	SetPullupConfigReg(MCP23017_PORTB, 0x02);
+	if(PINB & (1 << PINB1))
+	{
+		IoExpanderInterrupt(&mcp23017, MCP23017_PORTB);
+	}
 }
 
 /***************************************************************************
@@ -100,9 +135,29 @@ int main(void)
 	/* Setup and initialization */
 	Setup();
 	SetupIoExpander();
+	
+#ifdef MCP23017_SELF_TEST
+	/* Bench check of the driver, the result can be inspected with the debugger */
+	volatile uint16_t mismatches = SelfTestIoExpander(&mcp23017, 1000, 0xACE1);
+	(void)mismatches;
+#endif
 
     while (1) 
     {
+		struct MCP23017Event events[4];
+		
+		/* The pushbutton events, with the time they were pressed */
+		DrainEvents(events, 4);
+		
+		/* The INT line interrupts only mark the device, their reads are queued here */
+		IoExpanderServiceInterrupts();
+		
+		/* Sleep until the next INT line change, an interrupt after the check wakes the CPU right away */
+		cli();
+		if(!HasInterruptWork())
+		{
+			PowerSleep();
+		}
+		sei();
     }
 }
-
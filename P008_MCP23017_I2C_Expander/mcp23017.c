@@ -19,28 +19,39 @@
 /************************************************************************/
 #define F_CPU			16000000UL
 
+/* Interrupt servicing: pending bits of the ports and the device is in the waiting list */
+#define INTERRUPT_PORTS			((1 << MCP23017_PORTA) | (1 << MCP23017_PORTB))
+#define INTERRUPT_WAITING		0x80
 
 /************************************************************************/
 /* Includes
 /************************************************************************/
 #include <avr/io.h>
+#include <util/atomic.h>
 #include "util/delay.h"
 #include "mcp23017.h"
+#include "twi.h"
+#include "timer.h"
 #include "string.h"
+#include <stddef.h>
 
 
 /************************************************************************/
-/* Structures
+/* Variables
 /************************************************************************/
-struct MCP23017
-{
-	BYTE address;
-	BankInUse bank;
-	
-	/* Specifies if the IO Expander is initialized */
-	BOOL isInitialized;
-	
-}mcp23017;
+struct MCP23017 mcp23017;
+
+/* Interrupt event log, slots are reserved when the read is queued and published (head) by the TWI */
+/* interrupt in the same order because the interrupt reads share one priority. Drained by the main loop. */
+static struct MCP23017Event eventLog[MCP23017_EVENT_LOG_SIZE];
+static volatile BYTE eventReserved;
+static volatile BYTE eventHead;
+static volatile BYTE eventTail;
+static volatile uint16_t eventOverflows;
+
+/* Devices whose interrupt read is not queued yet: new interrupts and reads which wait for room */
+/* in the event log or the TWI queue */
+static struct MCP23017* waitingDevices;
 
 
 /************************************************************************/
@@ -48,742 +59,2096 @@ struct MCP23017
 /************************************************************************/	
 
 /***************************************************************************
-*  Function:		SetPortDirection(MCP23017_Port port, BYTE value)
-*  Description:		Sets the direction port register. When a bit is set the corresponding
-*				pin becomes an input and when its cleared the pin becomes an output.
-*  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
-*				BYTE value			:	The value to set.
-*  Returns:		Nothing
+*  Function:		BYTE GetRegisterAddress(BankInUse bank, BYTE reg)
+*  Description:		Translates a register address from the BANK0 map to the map
+*					of the given bank. The BANK0 address is the register pair
+*					shifted left with the port in bit 0, BANK1 has the port in
+*					bit 4, so the translation moves bit 0 to bit 4 (about 7 cycles
+*					instead of the compare chain of a switch, counted not measured).
+*  Receives:		BankInUse bank		:	The bank in use (BANK0 or BANK1).
+*					BYTE reg			:	The register address in BANK0 (MCP23017_IODIRA...).
+*  Returns:			The register address in the given bank.
 ***************************************************************************/
-void InitializeIoExpander(BYTE address, BankInUse bank)
+static BYTE GetRegisterAddress(BankInUse bank, BYTE reg)
 {
-	mcp23017.address = address;
-	mcp23017.bank = bank;
+	if(bank == BANK0)
+	{
+		return reg;
+	}
 	
-	/* Initialization finished, set flag */
-	mcp23017.isInitialized = TRUE:
+	return MCP23017_REGISTER_BANK1(reg >> 1, reg & 0x01);
 }
 
+/* Both register maps follow from the pair and port, checked for every register */
+#define MCP23017_CHECK_REGISTER(name, index) \
+	_Static_assert(MCP23017_REGISTER_BANK0(index, MCP23017_PORTA) == MCP23017_##name##A && \
+				   MCP23017_REGISTER_BANK0(index, MCP23017_PORTB) == MCP23017_##name##B && \
+				   MCP23017_REGISTER_BANK1(index, MCP23017_PORTA) == MCP23017_##name##A_BANK1 && \
+				   MCP23017_REGISTER_BANK1(index, MCP23017_PORTB) == MCP23017_##name##B_BANK1, #name " register address")
+
+MCP23017_CHECK_REGISTER(IODIR, MCP23017_INDEX_IODIR);
+MCP23017_CHECK_REGISTER(IPOL, MCP23017_INDEX_IPOL);
+MCP23017_CHECK_REGISTER(GPINTEN, MCP23017_INDEX_GPINTEN);
+MCP23017_CHECK_REGISTER(DEFVAL, MCP23017_INDEX_DEFVAL);
+MCP23017_CHECK_REGISTER(INTCON, MCP23017_INDEX_INTCON);
+MCP23017_CHECK_REGISTER(IOCON, MCP23017_INDEX_IOCON);
+MCP23017_CHECK_REGISTER(GPPU, MCP23017_INDEX_GPPU);
+MCP23017_CHECK_REGISTER(INTF, MCP23017_INDEX_INTF);
+MCP23017_CHECK_REGISTER(INTCAP, MCP23017_INDEX_INTCAP);
+MCP23017_CHECK_REGISTER(GPIO, MCP23017_INDEX_GPIO);
+MCP23017_CHECK_REGISTER(OLAT, MCP23017_INDEX_OLAT);
+
 /***************************************************************************
-  Function:		SetPortDirection(MCP23017_Port port, BYTE value)
-  Description:	Sets the direction port register. When a bit is set the corresponding
-				pin becomes an input and when its cleared the pin becomes an output.
-  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
-				BYTE value				:	The value to set.
-  Returns:		Nothing
+*  Function:		BYTE GetPriority(BYTE flags, BYTE statisticsClass)
+*  Description:		Selects the bus priority of a transaction by its registers.
+*  Receives:		BYTE flags				:	TWI_WRITE or TWI_READ.
+*					BYTE statisticsClass	:	The register class (MCP23017_CLASS_...).
+*  Returns:			The priority (TWI_PRIORITY_...).
 ***************************************************************************/
-void SetPortDirectionReg(MCP23017_Port port, BYTE value)
+static BYTE GetPriority(BYTE flags, BYTE statisticsClass)
 {
-	if(BankInUse == BANK0)
+	if(statisticsClass == MCP23017_CLASS_INTF || statisticsClass == MCP23017_CLASS_INTCAP)
 	{
-		if(port == MCP23017_PORTA)
-		{
-			TwiSend(address, MCP23017_IODIRA, value);
-		}
-		else if(port == MCP23017_PORTB)
-		{
-			TwiSend(address, MCP23017_IODIRB, value);
-		}
+		return TWI_PRIORITY_INTERRUPT;
 	}
-	else if(BankInUse == BANK1)
+	
+	if(statisticsClass == MCP23017_CLASS_GPIO || statisticsClass == MCP23017_CLASS_OLAT)
 	{
-		if(port == MCP23017_PORTA)
-		{
-			TwiSend(address, MCP23017_IODIRA_BANK1, value);
-		}
-		else if(port == MCP23017_PORTB)
-		{
-			TwiSend(address, MCP23017_IODIRB_BANK1, value);
-		}
+		return (flags & TWI_READ) ? TWI_PRIORITY_SCAN : TWI_PRIORITY_OUTPUT;
 	}
+	
+	return TWI_PRIORITY_DIAGNOSTIC;
 }
 
 /***************************************************************************
-  Function:		BYTE ReadPortDirection(MCP23017_Port port)
-				Bits which are set are inputs, and bit that are cleared are outputs.
-  Description:	Reads the direction port register.
-  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
-  Returns:		Byte that was read.
+*  Function:		BYTE WriteRegisters(struct MCP23017* device, BYTE reg, const BYTE* data, BYTE length, BYTE statisticsClass)
+*  Description:		Writes a number of bytes starting at a register of a device, blocking.
+*					The transaction is routed through the multiplexer of the device.
+*					Register map bursts (MCP23017_CLASS_BURST) are sequential and may
+*					be split by the TWI driver.
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					BYTE reg					:	The first register in the bank in use.
+*					const BYTE* data			:	The bytes to write.
+*					BYTE length					:	The number of bytes.
+*					BYTE statisticsClass		:	Statistics class (TWI_INSTRUMENTATION).
+*  Returns:			The final status of the transaction.
 ***************************************************************************/
-BYTE ReadPortDirectionReg(MCP23017_Port port)
+static BYTE WriteRegisters(struct MCP23017* device, BYTE reg, const BYTE* data, BYTE length, BYTE statisticsClass)
 {
-	BYTE byteRead = 0;
+	struct TwiRequest request = { .address = device->address, .reg = reg, .flags = TWI_WRITE, .length = length, .buffer = (BYTE*)data,
+								  .statisticsClass = statisticsClass, .mux = device->mux, .channel = device->channel,
+								  .priority = GetPriority(TWI_WRITE, statisticsClass) };
 	
-	if(BankInUse == BANK0)
-	{
-		if(port == MCP23017_PORTA)
-		{
-			byteRead = twi_read1byte(address, MCP23017_IODIRA);
-		}
-		else if(port == MCP23017_PORTB)
-		{
-			byteRead = twi_read1byte(address, MCP23017_IODIRB);
-		}
-	}
-	else if(BankInUse == BANK1)
+	if(statisticsClass == MCP23017_CLASS_BURST)
 	{
-		if(port == MCP23017_PORTA)
-		{
-			byteRead = twi_read1byte(address, MCP23017_IODIRA_BANK1);
-		}
-		else if(port == MCP23017_PORTB)
-		{
-			byteRead = twi_read1byte(address, MCP23017_IODIRB_BANK1);
-		}
+		request.flags |= TWI_SPLITTABLE;
 	}
 	
-	return byteRead;
+	return TwiTransfer(&request);
 }
 
 /***************************************************************************
-  Function:		SetPortPolarity(MCP23017_Port port, BYTE value)
-  Description:	Sets the port polarity register, when the corresponding bit is set
-				the GPIO register bit will reflect the inverted value of the pin.
-  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
-				BYTE value				:	The value to set.
-  Returns:		Nothing
+*  Function:		BYTE ReadRegisters(struct MCP23017* device, BYTE reg, BYTE* data, BYTE length, BYTE statisticsClass)
+*  Description:		Reads a number of bytes starting at a register of a device, blocking.
+*					The transaction is routed through the multiplexer of the device.
+*					Register map bursts (MCP23017_CLASS_BURST) are sequential and may
+*					be split by the TWI driver.
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					BYTE reg					:	The first register in the bank in use.
+*					BYTE* data					:	Room for the bytes read.
+*					BYTE length					:	The number of bytes, at least 1.
+*					BYTE statisticsClass		:	Statistics class (TWI_INSTRUMENTATION).
+*  Returns:			The final status of the transaction.
 ***************************************************************************/
-void SetPortPolarityReg(MCP23017_Port port, BYTE value)
+static BYTE ReadRegisters(struct MCP23017* device, BYTE reg, BYTE* data, BYTE length, BYTE statisticsClass)
 {
-	if(BankInUse == BANK0)
-	{
-		if(port == MCP23017_PORTA)
-		{
-			TwiSend(address, MCP23017_IPOLA, value);
-		}
-		else if(port == MCP23017_PORTB)
-		{
-			TwiSend(address, MCP23017_IPOLB, value);
-		}
-	}
-	else if(BankInUse == BANK1)
+	struct TwiRequest request = { .address = device->address, .reg = reg, .flags = TWI_READ, .length = length, .buffer = data,
+								  .statisticsClass = statisticsClass, .mux = device->mux, .channel = device->channel,
+								  .priority = GetPriority(TWI_READ, statisticsClass) };
+	
+	if(statisticsClass == MCP23017_CLASS_BURST)
 	{
-		if(port == MCP23017_PORTA)
-		{
-			TwiSend(address, MCP23017_IPOLA_BANK1, value);
-		}
-		else if(port == MCP23017_PORTB)
-		{
-			TwiSend(address, MCP23017_IPOLB_BANK1, value);
-		}
+		request.flags |= TWI_SPLITTABLE;
 	}
+	
+	return TwiTransfer(&request);
 }
 
 /***************************************************************************
-  Function:		BYTE ReadPortDirection(MCP23017_Port port)
-  Description:	Reads the input polarity register.
-  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
-  Returns:		Byte that was read.
+*  Function:		WriteRegister(struct MCP23017* device, BYTE reg, BYTE value, BYTE statisticsClass)
+*  Description:		Writes a single register of a device, blocking.
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					BYTE reg					:	The register in the bank in use.
+*					BYTE value					:	The value to write.
+*					BYTE statisticsClass		:	Statistics class (TWI_INSTRUMENTATION).
+*  Returns:			Nothing
 ***************************************************************************/
-BYTE ReadPortPolarityReg(MCP23017_Port port)
+static void WriteRegister(struct MCP23017* device, BYTE reg, BYTE value, BYTE statisticsClass)
+{
+	WriteRegisters(device, reg, &value, 1, statisticsClass);
+}
+
+/***************************************************************************
+*  Function:		BYTE ReadRegister(struct MCP23017* device, BYTE reg, BYTE statisticsClass)
+*  Description:		Reads a single register of a device, blocking.
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					BYTE reg					:	The register in the bank in use.
+*					BYTE statisticsClass		:	Statistics class (TWI_INSTRUMENTATION).
+*  Returns:			Byte that was read, 0 when the transaction failed.
+***************************************************************************/
+static BYTE ReadRegister(struct MCP23017* device, BYTE reg, BYTE statisticsClass)
 {
-	BYTE byteRead = 0;
+	BYTE value = 0;
 	
-	if(BankInUse == BANK0)
-	{
-		if(port == MCP23017_PORTA)
-		{
-			byteRead = twi_read1byte(address, MCP23017_IPOLA);
-		}
-		else if(port == MCP23017_PORTB)
-		{
-			byteRead = twi_read1byte(address, MCP23017_IPOLB);
-		}
-	}
-	else if(BankInUse == BANK1)
-	{
-		if(port == MCP23017_PORTA)
-		{
-			byteRead = twi_read1byte(address, MCP23017_IPOLA_BANK1);
-		}
-		else if(port == MCP23017_PORTB)
-		{
-			byteRead = twi_read1byte(address, MCP23017_IPOLB_BANK1);
-		}
-	}
+	ReadRegisters(device, reg, &value, 1, statisticsClass);
 	
-	return byteRead;
+	return value;
 }
 
 /***************************************************************************
-  Function:		SetIntOnChange(MCP23017_Port port, BYTE value)
-  Description:	Sets the interrupt-on-change register, if a bit is set the
-				corresponding pin is enabled for interrupt-on-change.
-  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
-				BYTE value				:	The value to set.
-  Returns:		Nothing
+*  Function:		PrepareRequest(struct MCP23017* device, struct TwiRequest* request, BYTE reg,
+*								   BYTE flags, BYTE* buffer, BYTE length)
+*  Description:		Fills a request for a register of a device, routed through its
+*					multiplexer. The callback and the deadline of the request are left
+*					as they are.
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					struct TwiRequest* request	:	The request.
+*					BYTE reg					:	The register address in BANK0 (MCP23017_IODIRA...).
+*					BYTE flags					:	TWI_WRITE or TWI_READ.
+*					BYTE* buffer				:	The data.
+*					BYTE length					:	The number of bytes.
+*  Returns:			Nothing
 ***************************************************************************/
-void SetIntOnChangeReg(MCP23017_Port port, BYTE value)
+static void PrepareRequest(struct MCP23017* device, struct TwiRequest* request, BYTE reg, BYTE flags, BYTE* buffer, BYTE length)
+{
+	request->address = device->address;
+	request->mux = device->mux;
+	request->channel = device->channel;
+	request->reg = GetRegisterAddress(device->bank, reg);
+	request->flags = flags;
+	request->buffer = buffer;
+	request->length = length;
+	request->statisticsClass = reg >> 1;
+	request->priority = GetPriority(flags, reg >> 1);
+	request->next = NULL;
+}
+
+/***************************************************************************
+*  Function:		BOOL SubmitIoConfig(struct MCP23017* device, struct TwiRequest* request, BYTE value)
+*  Description:		Queues the IOCON write and switches the driver to the bank selected
+*					by the BANK bit in one atomic step. The write is only queued when
+*					no request is waiting or on the bus, so every request queued before
+*					(old address map and mode) is finished. It has the highest priority,
+*					so every request queued after (also from interrupts and at interrupt
+*					priority) follows it with the new map. The shadow is in BANK0 order
+*					and stays valid. The value is kept in the device, only one IOCON
+*					write can be pending.
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					struct TwiRequest* request	:	The request, owned by the TWI driver while pending.
+*					BYTE value					:	The value to write to IOCON.
+*  Returns:			TRUE when the write was queued, FALSE when the bus is busy (try again later).
+***************************************************************************/
+static BOOL SubmitIoConfig(struct MCP23017* device, struct TwiRequest* request, BYTE value)
 {
-	if(BankInUse == BANK0)
+	BOOL submitted = FALSE;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 	{
-		if(port == MCP23017_PORTA)
+		if(TwiIsIdle())
 		{
-			TwiSend(address, MCP23017_GPINTENA, value);
+			device->ioconWrite = value;
+			PrepareRequest(device, request, MCP23017_IOCON, TWI_WRITE, &device->ioconWrite, 1);
+			request->priority = TWI_PRIORITY_INTERRUPT;
+			submitted = TwiSubmit(request);
 		}
-		else if(port == MCP23017_PORTB)
+		
+		if(submitted)
 		{
-			TwiSend(address, MCP23017_GPINTENB, value);
+			device->bank = (value & MCP23017_BANK) ? BANK1 : BANK0;
+			device->shadow.iocon[MCP23017_PORTA] = value;
+			device->shadow.iocon[MCP23017_PORTB] = value;
 		}
 	}
-	else if(BankInUse == BANK1)
+	
+	return submitted;
+}
+
+/***************************************************************************
+*  Function:		WriteIoConfig(struct MCP23017* device, BYTE value)
+*  Description:		Writes IOCON and switches the driver to the bank selected by the
+*					BANK bit, blocking (see SubmitIoConfig).
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					BYTE value					:	The value to write to IOCON.
+*  Returns:			Nothing
+***************************************************************************/
+static void WriteIoConfig(struct MCP23017* device, BYTE value)
+{
+	struct TwiRequest request = { .callback = NULL };
+	
+	while(!SubmitIoConfig(device, &request, value))
 	{
-		if(port == MCP23017_PORTA)
-		{
-			TwiSend(address, MCP23017_GPINTENA_BANK1, value);
-		}
-		else if(port == MCP23017_PORTB)
-		{
-			TwiSend(address, MCP23017_GPINTENB_BANK1, value);
-		}
 	}
+	
+	TwiWait(&request);
 }
 
 /***************************************************************************
-  Function:		BYTE ReadIntOnChange(MCP23017_Port port)
-  Description:	Reads the interrupt-on-change register.
-  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
-  Returns:		Byte that was read.
+*  Function:		InitializeIoExpander(BYTE address, BankInUse bank)
+*  Description:		Initializes the driver for the directly connected IO Expander
+*					(mcp23017), see InitializeIoExpanderDevice().
+*  Receives:		BYTE address		:	The 7-bit address of the IO Expander.
+*					BankInUse bank		:	The bank to use (BANK0 or BANK1).
+*  Returns:			Nothing
 ***************************************************************************/
-BYTE ReadIntOnChangeReg(MCP23017_Port port)
+void InitializeIoExpander(BYTE address, BankInUse bank)
 {
-	BYTE byteRead = 0;
+	InitializeIoExpanderDevice(&mcp23017, address, NULL, 0, bank);
+}
+
+/***************************************************************************
+*  Function:		InitializeIoExpanderDevice(struct MCP23017* device, BYTE address, struct TwiMux* mux,
+*											   BYTE channel, BankInUse bank)
+*  Description:		Initializes the driver and puts the IO Expander in its power-on
+*					reset state, whatever state it is in: after a reset of the MCU
+*					alone (watchdog, brown-out, reset button) the IO Expander keeps its
+*					registers and may be in BANK1. 0x00 is written to 0x05 (IOCON in
+*					BANK1, GPINTENB in BANK0) and then to 0x0A (IOCON in BANK0), after
+*					that the device is in BANK0 with sequential operation and all other
+*					registers get their reset values in one burst. INTCAP is read to
+*					clear an interrupt of before the reset. When BANK1 is requested
+*					IOCON.BANK is written.
+*					Behind a multiplexer up to 8 IO Expanders per channel can be used,
+*					devices on different channels may have the same address.
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					BYTE address				:	The 7-bit address of the IO Expander.
+*					struct TwiMux* mux			:	The multiplexer, NULL when directly connected.
+*					BYTE channel				:	The channel of the multiplexer (0-7).
+*					BankInUse bank				:	The bank to use (BANK0 or BANK1).
+*  Returns:			Nothing
+***************************************************************************/
+void InitializeIoExpanderDevice(struct MCP23017* device, BYTE address, struct TwiMux* mux, BYTE channel, BankInUse bank)
+{
+	union MCP23017Registers reset;
+	BYTE zero = 0x00;
+	BOOL online;
 	
-	if(BankInUse == BANK0)
+	/* Power-on reset values */
+	memset(&reset, 0, sizeof(reset));
+	reset.iodir[MCP23017_PORTA] = MCP23017_IODIR_DEFAULT;
+	reset.iodir[MCP23017_PORTB] = MCP23017_IODIR_DEFAULT;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 	{
-		if(port == MCP23017_PORTA)
-		{
-			byteRead = twi_read1byte(address, MCP23017_GPINTENA);
-		}
-		else if(port == MCP23017_PORTB)
-		{
-			byteRead = twi_read1byte(address, MCP23017_GPINTENB);
-		}
+		device->isInitialized = FALSE;
+		device->address = address;
+		device->mux = mux;
+		device->channel = channel;
+		device->bank = BANK0;
 	}
-	else if(BankInUse == BANK1)
+	
+	/* Addresses of both maps, the chip is in BANK0 with IOCON cleared afterwards */
+	online = (WriteRegisters(device, MCP23017_IOCON_BANK1, &zero, 1, MCP23017_CLASS_IOCON) == TWI_STATUS_DONE);
+	WriteRegisters(device, MCP23017_IOCON, &zero, 1, MCP23017_CLASS_IOCON);
+	WriteRegisters(device, MCP23017_IODIRA, reset.raw, MCP23017_REGISTER_COUNT, MCP23017_CLASS_BURST);
+	ReadRegisters(device, MCP23017_INTCAPA, reset.intcap, sizeof(reset.intcap), MCP23017_CLASS_INTCAP);
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 	{
-		if(port == MCP23017_PORTA)
-		{
-			byteRead = twi_read1byte(address, MCP23017_GPINTENA_BANK1);
-		}
-		else if(port == MCP23017_PORTB)
-		{
-			byteRead = twi_read1byte(address, MCP23017_GPINTENB_BANK1);
-		}
+		/* The shadow starts with the power-on reset values */
+		memset(&device->shadow, 0, sizeof(device->shadow));
+		device->shadow.iodir[MCP23017_PORTA] = MCP23017_IODIR_DEFAULT;
+		device->shadow.iodir[MCP23017_PORTB] = MCP23017_IODIR_DEFAULT;
+	
+		/* Initialization finished, set flag */
+		device->isInitialized = TRUE;
+		device->isOnline = online;
 	}
 	
-	return byteRead;
+	SwitchBank(device, bank);
 }
 
 /***************************************************************************
-  Function:		SetDefaultCompareReg(MCP23017_Port port, BYTE value)
-  Description:	Sets the default compare register, these bits set the compare value
-				for pins configured for interrupt-on-change, if the associated pin
-				level is the opposite from the register bit, an interrupt occurs.
-  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
-				BYTE value				:	The value to set.
-  Returns:		Nothing
+*  Function:		UpdateShadow(struct MCP23017* device, BYTE reg, BYTE value)
+*  Description:		Stores a value written to a register (not IOCON) in the shadow.
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					BYTE reg					:	The register address in BANK0 (MCP23017_IODIRA...).
+*					BYTE value					:	The value written.
+*  Returns:			Nothing
 ***************************************************************************/
-void SetDefaultCompareReg(MCP23017_Port port, BYTE value)
+static void UpdateShadow(struct MCP23017* device, BYTE reg, BYTE value)
 {
-	if(BankInUse == BANK0)
+	/* Writing the port register modifies the output latch */
+	if(reg == MCP23017_GPIOA || reg == MCP23017_GPIOB)
 	{
-		if(port == MCP23017_PORTA)
-		{
-			TwiSend(address, MCP23017_DEFVALA, value);
-		}
-		else if(port == MCP23017_PORTB)
-		{
-			TwiSend(address, MCP23017_DEFVALB, value);
-		}
+		device->shadow.raw[reg + (MCP23017_OLATA - MCP23017_GPIOA)] = value;
 	}
-	else if(BankInUse == BANK1)
+	
+	device->shadow.raw[reg] = value;
+}
+
+/***************************************************************************
+*  Function:		WriteIoExpanderRegister(struct MCP23017* device, BYTE reg, BYTE value)
+*  Description:		Writes a register of a device and updates the shadow, the register
+*					is given by its BANK0 address and translated to the bank in use.
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					BYTE reg					:	The register address in BANK0 (MCP23017_IODIRA...).
+*					BYTE value					:	The value to write.
+*  Returns:			Nothing
+***************************************************************************/
+void WriteIoExpanderRegister(struct MCP23017* device, BYTE reg, BYTE value)
+{
+	if(reg == MCP23017_IOCONA || reg == MCP23017_IOCONB)
 	{
-		if(port == MCP23017_PORTA)
-		{
-			TwiSend(address, MCP23017_DEFVALA_BANK1, value);
-		}
-		else if(port == MCP23017_PORTB)
-		{
-			TwiSend(address, MCP23017_DEFVALB_BANK1, value);
-		}
+		WriteIoConfig(device, value);
+		return;
 	}
+	
+	UpdateShadow(device, reg, value);
+	WriteRegister(device, GetRegisterAddress(device->bank, reg), value, reg >> 1);
 }
 
 /***************************************************************************
-  Function:		BYTE ReadDefaultCompareReg(MCP23017_Port port)
-  Description:	Reads the default compare register for interrupt-on-change.
-  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
-  Returns:		Byte that was read.
+*  Function:		BYTE ReadIoExpanderRegister(struct MCP23017* device, BYTE reg)
+*  Description:		Reads a register of a device, the register is given by its BANK0
+*					address and translated to the bank in use.
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					BYTE reg					:	The register address in BANK0 (MCP23017_IODIRA...).
+*  Returns:			Byte that was read.
 ***************************************************************************/
-BYTE ReadDefaultCompareReg(MCP23017_Port port)
+BYTE ReadIoExpanderRegister(struct MCP23017* device, BYTE reg)
 {
-	BYTE byteRead = 0;
-	
-	if(BankInUse == BANK0)
+	return ReadRegister(device, GetRegisterAddress(device->bank, reg), reg >> 1);
+}
+
+/***************************************************************************
+*  Function:		BOOL WriteIoExpanderRegisterAsync(struct MCP23017* device, struct TwiRequest* request,
+*													  BYTE reg, const BYTE* value)
+*  Description:		Queues the write of a register and returns directly, the shadow is
+*					updated right away. Completion is signalled by the status of the
+*					request (ASYNC_AWAIT) or by its callback, which has to be set
+*					before the call. Every Set... function has this form. An IOCON
+*					write waits for an idle bus (see SubmitIoConfig).
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					struct TwiRequest* request	:	The request, owned by the TWI driver while pending.
+*					BYTE reg					:	The register address in BANK0 (MCP23017_IODIRA...).
+*					const BYTE* value			:	The value to write, must stay valid while pending.
+*  Returns:			TRUE when the write was queued, FALSE when the queue is full or, for
+*					IOCON, the bus is busy (try again later).
+***************************************************************************/
+BOOL WriteIoExpanderRegisterAsync(struct MCP23017* device, struct TwiRequest* request, BYTE reg, const BYTE* value)
+{
+	if(reg == MCP23017_IOCONA || reg == MCP23017_IOCONB)
 	{
-		if(port == MCP23017_PORTA)
-		{
-			byteRead = twi_read1byte(address, MCP23017_DEFVALA);
-		}
-		else if(port == MCP23017_PORTB)
-		{
-			byteRead = twi_read1byte(address, MCP23017_DEFVALB);
-		}
+		return SubmitIoConfig(device, request, *value);
 	}
-	else if(BankInUse == BANK1)
+	
+	PrepareRequest(device, request, reg, TWI_WRITE, (BYTE*)value, 1);
+	
+	if(!TwiSubmit(request))
 	{
-		if(port == MCP23017_PORTA)
-		{
-			byteRead = twi_read1byte(address, MCP23017_DEFVALA_BANK1);
-		}
-		else if(port == MCP23017_PORTB)
-		{
-			byteRead = twi_read1byte(address, MCP23017_DEFVALB_BANK1);
-		}
+		return FALSE;
 	}
 	
-	return byteRead;
+	UpdateShadow(device, reg, *value);
+	
+	return TRUE;
 }
 
 /***************************************************************************
-  Function:		SetIntControlReg(MCP23017_Port port, BYTE value)
-  Description:	Sets the interrupt control register, this register controls how the associated
-				pin value is compared for the interrupt-on-change.
-				If a bit is set, the corresponding IO pin is compared against the
-				associated bit in the DEFVAL register.
-				If a bit value is clear, the corresponding IO pin is compared against the previous value.
-  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
-				BYTE value				:	The value to set.
-  Returns:		Nothing
+*  Function:		BOOL ReadIoExpanderRegisterAsync(struct MCP23017* device, struct TwiRequest* request,
+*													 BYTE reg, BYTE* value)
+*  Description:		Queues the read of a register and returns directly. The value is
+*					valid when the status of the request is TWI_STATUS_DONE.
+*					Every Read... function has this form.
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					struct TwiRequest* request	:	The request, owned by the TWI driver while pending.
+*					BYTE reg					:	The register address in BANK0 (MCP23017_IODIRA...).
+*					BYTE* value					:	Receives the value, written by the TWI interrupt.
+*  Returns:			TRUE when the read was queued, FALSE when the queue is full (try again later).
 ***************************************************************************/
-void SetIntControlReg(MCP23017_Port port, BYTE value)
+BOOL ReadIoExpanderRegisterAsync(struct MCP23017* device, struct TwiRequest* request, BYTE reg, BYTE* value)
+{
+	PrepareRequest(device, request, reg, TWI_READ, value, 1);
+	
+	return TwiSubmit(request);
+}
+
+/***************************************************************************
+*  Function:		BYTE GetBurstRegister(struct MCP23017* device, BYTE reg, BYTE index)
+*  Description:		Returns the BANK0 address of a register of a burst, the burst
+*					follows the address order of the bank in use.
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					BYTE reg					:	The first register in BANK0.
+*					BYTE index					:	The position in the burst.
+*  Returns:			The register address in BANK0.
+***************************************************************************/
+static BYTE GetBurstRegister(struct MCP23017* device, BYTE reg, BYTE index)
+{
+	/* BANK1 keeps the registers of the port of the first register together */
+	return (device->bank == BANK0) ? (BYTE)(reg + index) : (BYTE)((((reg >> 1) + index) << 1) | (reg & 0x01));
+}
+
+/***************************************************************************
+*  Function:		BOOL IsBurstInMap(struct MCP23017* device, BYTE reg, BYTE length)
+*  Description:		Checks if a burst stays within the register map of the bank in use,
+*					in BANK1 within the registers of the port of the first register.
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					BYTE reg					:	The first register in BANK0.
+*					BYTE length					:	The number of registers.
+*  Returns:			TRUE when every register of the burst exists.
+***************************************************************************/
+static BOOL IsBurstInMap(struct MCP23017* device, BYTE reg, BYTE length)
 {
-	if(BankInUse == BANK0)
+	if(length == 0 || reg >= MCP23017_REGISTER_COUNT)
 	{
-		if(port == MCP23017_PORTA)
-		{
-			TwiSend(address, MCP23017_INTCONA, value);
-		}
-		else if(port == MCP23017_PORTB)
-		{
-			TwiSend(address, MCP23017_INTCONB, value);
-		}
+		return FALSE;
 	}
-	else if(BankInUse == BANK1)
+	
+	if(device->bank == BANK0)
 	{
-		if(port == MCP23017_PORTA)
-		{
-			TwiSend(address, MCP23017_INTCONA_BANK1, value);
-		}
-		else if(port == MCP23017_PORTB)
-		{
-			TwiSend(address, MCP23017_INTCONB_BANK1, value);
-		}
+		return (length <= MCP23017_REGISTER_COUNT - reg);
 	}
+	
+	return (length <= (MCP23017_REGISTER_COUNT / 2) - (reg >> 1));
 }
 
 /***************************************************************************
-  Function:		BYTE ReadIntControlReg(MCP23017_Port port)
-  Description:	Reads the interrupt control register.
-  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
-  Returns:		Byte that was read.
+*  Function:		BOOL SubmitBurst(struct MCP23017* device, struct TwiRequest* request, BYTE reg,
+*								 BYTE flags, BYTE* data, BYTE length)
+*  Description:		Queues a sequential burst on the caller's buffer, the TWI interrupt
+*					reads or writes the buffer directly. Writes update the shadow.
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					struct TwiRequest* request	:	The request, owned by the TWI driver while pending.
+*					BYTE reg					:	The first register in BANK0.
+*					BYTE flags					:	TWI_WRITE or TWI_READ.
+*					BYTE* data					:	The caller's buffer.
+*					BYTE length					:	The number of registers, at least 1.
+*  Returns:			TRUE when the burst was queued, FALSE when the queue is full or the
+*					burst leaves the register map.
 ***************************************************************************/
-BYTE ReadIntControlReg(MCP23017_Port port)
+static BOOL SubmitBurst(struct MCP23017* device, struct TwiRequest* request, BYTE reg, BYTE flags, BYTE* data, BYTE length)
 {
-	BYTE byteRead = 0;
+	BYTE i;
 	
-	if(BankInUse == BANK0)
+	if(!IsBurstInMap(device, reg, length))
 	{
-		if(port == MCP23017_PORTA)
-		{
-			byteRead = twi_read1byte(address, MCP23017_INTCONA);
-		}
-		else if(port == MCP23017_PORTB)
-		{
-			byteRead = twi_read1byte(address, MCP23017_INTCONB);
-		}
+		return FALSE;
 	}
-	else if(BankInUse == BANK1)
+	
+	PrepareRequest(device, request, reg, flags | TWI_SPLITTABLE, data, length);
+	request->statisticsClass = MCP23017_CLASS_BURST;
+	
+	if(!TwiSubmit(request))
 	{
-		if(port == MCP23017_PORTA)
-		{
-			byteRead = twi_read1byte(address, MCP23017_INTCONA_BANK1);
-		}
-		else if(port == MCP23017_PORTB)
+		return FALSE;
+	}
+	
+	if(!(flags & TWI_READ))
+	{
+		for(i = 0; i < length; i++)
 		{
-			byteRead = twi_read1byte(address, MCP23017_INTCONB_BANK1);
+			UpdateShadow(device, GetBurstRegister(device, reg, i), data[i]);
 		}
 	}
 	
-	return byteRead;
+	return TRUE;
 }
 
 /***************************************************************************
-  Function:		SetIoConfigReg(MCP23017_Port port, BYTE value)
-  Description:	Sets the IO Expander Configuration register, this register contains settings
-				that determine how the IO Expander behaves.
-  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
-				BYTE value				:	The value to set.
-  Returns:		Nothing
+*  Function:		BYTE WriteIoExpanderBurst(struct MCP23017* device, BYTE reg, const BYTE* data, BYTE length)
+*  Description:		Writes a block of registers in one sequential transaction, blocking.
+*					Sequential operation is enabled when needed. The block follows the
+*					address order of the bank in use: A/B pairs in BANK0, the registers
+*					of one port in BANK1. When the block contains IOCON the BANK and
+*					SEQOP bits must not change.
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					BYTE reg					:	The first register in BANK0 (MCP23017_IODIRA...).
+*					const BYTE* data			:	The values, read directly by the TWI interrupt.
+*					BYTE length					:	The number of registers, at least 1.
+*  Returns:			The status of the transaction (TWI_STATUS_...), TWI_STATUS_INVALID
+*					when the block leaves the register map.
 ***************************************************************************/
-void SetIoConfigReg(MCP23017_Port port, BYTE value)
+BYTE WriteIoExpanderBurst(struct MCP23017* device, BYTE reg, const BYTE* data, BYTE length)
 {
-	if(BankInUse == BANK0)
+	struct TwiRequest request = { .callback = NULL };
+	
+	if(!IsBurstInMap(device, reg, length))
 	{
-		if(port == MCP23017_PORTA)
-		{
-			TwiSend(address, MCP23017_IOCONA, value);
-		}
-		else if(port == MCP23017_PORTB)
-		{
-			TwiSend(address, MCP23017_IOCONB, value);
-		}
+		return TWI_STATUS_INVALID;
 	}
-	else if(BankInUse == BANK1)
+	
+	SetSequentialOperation(device, TRUE);
+	
+	while(!SubmitBurst(device, &request, reg, TWI_WRITE, (BYTE*)data, length))
 	{
-		if(port == MCP23017_PORTA)
-		{
-			TwiSend(address, MCP23017_IOCONA_BANK1, value);
-		}
-		else if(port == MCP23017_PORTB)
-		{
-			TwiSend(address, MCP23017_IOCONB_BANK1, value);
-		}
 	}
+	
+	return TwiWait(&request);
 }
 
 /***************************************************************************
-  Function:		BYTE ReadIntControlReg(MCP23017_Port port)
-  Description:	Reads the IO Expander Configuration register.
-  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
-  Returns:		Byte that was read.
+*  Function:		BYTE ReadIoExpanderBurst(struct MCP23017* device, BYTE reg, BYTE* data, BYTE length)
+*  Description:		Reads a block of registers in one sequential transaction, blocking.
+*					Sequential operation is enabled when needed, the address order is
+*					the one of WriteIoExpanderBurst().
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					BYTE reg					:	The first register in BANK0 (MCP23017_IODIRA...).
+*					BYTE* data					:	Receives the values, written directly by the TWI interrupt.
+*					BYTE length					:	The number of registers, at least 1.
+*  Returns:			The status of the transaction (TWI_STATUS_...), TWI_STATUS_INVALID
+*					when the block leaves the register map.
 ***************************************************************************/
-BYTE ReadIoConfigReg(MCP23017_Port port)
+BYTE ReadIoExpanderBurst(struct MCP23017* device, BYTE reg, BYTE* data, BYTE length)
 {
-	BYTE byteRead = 0;
+	struct TwiRequest request = { .callback = NULL };
 	
-	if(BankInUse == BANK0)
+	if(!IsBurstInMap(device, reg, length))
 	{
-		if(port == MCP23017_PORTA)
+		return TWI_STATUS_INVALID;
+	}
+	
+	SetSequentialOperation(device, TRUE);
+	
+	while(!SubmitBurst(device, &request, reg, TWI_READ, data, length))
+	{
+	}
+	
+	return TwiWait(&request);
+}
+
+/***************************************************************************
+*  Function:		BOOL WriteIoExpanderBurstAsync(struct MCP23017* device, struct TwiRequest* request,
+*												   BYTE reg, const BYTE* data, BYTE length)
+*  Description:		Queues the write of a block of registers and returns directly. The
+*					buffer belongs to the TWI driver until the status of the request is
+*					no longer pending (or its callback is called), it is not copied.
+*					Requires sequential operation (IOCON.SEQOP cleared).
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					struct TwiRequest* request	:	The request, owned by the TWI driver while pending.
+*					BYTE reg					:	The first register in BANK0 (MCP23017_IODIRA...).
+*					const BYTE* data			:	The values, must stay valid while pending.
+*					BYTE length					:	The number of registers, at least 1.
+*  Returns:			TRUE when the write was queued, FALSE when the queue is full (try again later)
+*					or the block leaves the register map.
+***************************************************************************/
+BOOL WriteIoExpanderBurstAsync(struct MCP23017* device, struct TwiRequest* request, BYTE reg, const BYTE* data, BYTE length)
+{
+	return SubmitBurst(device, request, reg, TWI_WRITE, (BYTE*)data, length);
+}
+
+/***************************************************************************
+*  Function:		BOOL ReadIoExpanderBurstAsync(struct MCP23017* device, struct TwiRequest* request,
+*												  BYTE reg, BYTE* data, BYTE length)
+*  Description:		Queues the read of a block of registers and returns directly. The
+*					buffer belongs to the TWI driver until the status of the request is
+*					no longer pending, the values are then valid when the status is
+*					TWI_STATUS_DONE. Requires sequential operation (IOCON.SEQOP cleared).
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					struct TwiRequest* request	:	The request, owned by the TWI driver while pending.
+*					BYTE reg					:	The first register in BANK0 (MCP23017_IODIRA...).
+*					BYTE* data					:	Receives the values, written directly by the TWI interrupt.
+*					BYTE length					:	The number of registers, at least 1.
+*  Returns:			TRUE when the read was queued, FALSE when the queue is full (try again later)
+*					or the block leaves the register map.
+***************************************************************************/
+BOOL ReadIoExpanderBurstAsync(struct MCP23017* device, struct TwiRequest* request, BYTE reg, BYTE* data, BYTE length)
+{
+	return SubmitBurst(device, request, reg, TWI_READ, data, length);
+}
+
+/***************************************************************************
+*  Function:		SetSequentialOperation(struct MCP23017* device, BOOL enabled)
+*  Description:		Enables or disables sequential operation (IOCON.SEQOP), IOCON is
+*					only written when the mode changes. With sequential operation the
+*					address pointer increments after every byte, without it the pointer
+*					stays on the register (BANK1) or toggles within the A/B pair (BANK0).
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					BOOL enabled				:	TRUE to enable sequential operation.
+*  Returns:			Nothing
+***************************************************************************/
+void SetSequentialOperation(struct MCP23017* device, BOOL enabled)
+{
+	BYTE iocon = device->shadow.iocon[MCP23017_PORTA];
+	
+	/* SEQOP is active low: a set bit disables sequential operation */
+	if(enabled && (iocon & MCP23017_SEQOP))
+	{
+		WriteIoConfig(device, iocon & ~MCP23017_SEQOP);
+	}
+	else if(!enabled && !(iocon & MCP23017_SEQOP))
+	{
+		WriteIoConfig(device, iocon | MCP23017_SEQOP);
+	}
+}
+
+/***************************************************************************
+*  Function:		SwitchBank(struct MCP23017* device, BankInUse bank)
+*  Description:		Switches the register map by writing IOCON.BANK. BANK1 keeps the
+*					registers of a port together (fast toggling of one port's GPIO/OLAT
+*					with sequential operation disabled), BANK0 pairs the A/B registers
+*					(16-bit bursts).
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					BankInUse bank				:	The bank to switch to (BANK0 or BANK1).
+*  Returns:			Nothing
+***************************************************************************/
+void SwitchBank(struct MCP23017* device, BankInUse bank)
+{
+	if(bank == device->bank)
+	{
+		return;
+	}
+	
+	if(bank == BANK1)
+	{
+		WriteIoConfig(device, device->shadow.iocon[MCP23017_PORTA] | MCP23017_BANK);
+	}
+	else
+	{
+		WriteIoConfig(device, device->shadow.iocon[MCP23017_PORTA] & ~MCP23017_BANK);
+	}
+}
+
+/***************************************************************************
+*  Function:		BOOL SubmitIoConfigChange(struct MCP23017* device, struct TwiRequest* request, BYTE value)
+*  Description:		Queues an IOCON write (see SubmitIoConfig) when the value differs from
+*					the shadow. Otherwise nothing is queued, the status of the request is
+*					set to TWI_STATUS_DONE and its callback is not called.
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					struct TwiRequest* request	:	The request, owned by the TWI driver while pending.
+*					BYTE value					:	The value to write to IOCON.
+*  Returns:			TRUE when the write was queued or not needed, FALSE when the bus is
+*					busy (try again later).
+***************************************************************************/
+static BOOL SubmitIoConfigChange(struct MCP23017* device, struct TwiRequest* request, BYTE value)
+{
+	if(value == device->shadow.iocon[MCP23017_PORTA])
+	{
+		request->status = TWI_STATUS_DONE;
+		
+		return TRUE;
+	}
+	
+	return SubmitIoConfig(device, request, value);
+}
+
+/***************************************************************************
+*  Function:		BOOL SetSequentialOperationAsync(struct MCP23017* device, struct TwiRequest* request, BOOL enabled)
+*  Description:		Queues the IOCON write of SetSequentialOperation() and returns
+*					directly. The write waits for an idle bus (see SubmitIoConfig), when
+*					the mode does not change nothing is queued and the status of the
+*					request is TWI_STATUS_DONE right away.
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					struct TwiRequest* request	:	The request, owned by the TWI driver while pending.
+*					BOOL enabled				:	TRUE to enable sequential operation.
+*  Returns:			TRUE when the write was queued or not needed, FALSE when the bus is
+*					busy (try again later).
+***************************************************************************/
+BOOL SetSequentialOperationAsync(struct MCP23017* device, struct TwiRequest* request, BOOL enabled)
+{
+	BYTE iocon = device->shadow.iocon[MCP23017_PORTA];
+	
+	return SubmitIoConfigChange(device, request, enabled ? (iocon & ~MCP23017_SEQOP) : (iocon | MCP23017_SEQOP));
+}
+
+/***************************************************************************
+*  Function:		BOOL SwitchBankAsync(struct MCP23017* device, struct TwiRequest* request, BankInUse bank)
+*  Description:		Queues the IOCON write of SwitchBank() and returns directly. The
+*					driver uses the new register map for every request queued after the
+*					call. The write waits for an idle bus (see SubmitIoConfig), when the
+*					bank does not change nothing is queued and the status of the request
+*					is TWI_STATUS_DONE right away.
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					struct TwiRequest* request	:	The request, owned by the TWI driver while pending.
+*					BankInUse bank				:	The bank to switch to (BANK0 or BANK1).
+*  Returns:			TRUE when the write was queued or not needed, FALSE when the bus is
+*					busy (try again later).
+***************************************************************************/
+BOOL SwitchBankAsync(struct MCP23017* device, struct TwiRequest* request, BankInUse bank)
+{
+	BYTE iocon = device->shadow.iocon[MCP23017_PORTA];
+	
+	return SubmitIoConfigChange(device, request, (bank == BANK1) ? (iocon | MCP23017_BANK) : (iocon & ~MCP23017_BANK));
+}
+
+/***************************************************************************
+  Function:		SetPortDirection(MCP23017_Port port, BYTE value)
+  Description:	Sets the direction port register. When a bit is set the corresponding
+				pin becomes an input and when its cleared the pin becomes an output.
+  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
+				BYTE value				:	The value to set.
+  Returns:		Nothing
+***************************************************************************/
+void SetPortDirectionReg(MCP23017_Port port, BYTE value)
+{
+	mcp23017.shadow.iodir[port] = value;
+	
+	WriteRegister(&mcp23017, MCP23017_REGISTER(mcp23017.bank, MCP23017_INDEX_IODIR, port), value, MCP23017_CLASS_IODIR);
+}
+
+/***************************************************************************
+  Function:		BYTE ReadPortDirection(MCP23017_Port port)
+				Bits which are set are inputs, and bit that are cleared are outputs.
+  Description:	Reads the direction port register.
+  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
+  Returns:		Byte that was read.
+***************************************************************************/
+BYTE ReadPortDirectionReg(MCP23017_Port port)
+{
+	return ReadRegister(&mcp23017, MCP23017_REGISTER(mcp23017.bank, MCP23017_INDEX_IODIR, port), MCP23017_CLASS_IODIR);
+}
+
+/***************************************************************************
+  Function:		SetPortPolarity(MCP23017_Port port, BYTE value)
+  Description:	Sets the port polarity register, when the corresponding bit is set
+				the GPIO register bit will reflect the inverted value of the pin.
+  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
+				BYTE value				:	The value to set.
+  Returns:		Nothing
+***************************************************************************/
+void SetPortPolarityReg(MCP23017_Port port, BYTE value)
+{
+	mcp23017.shadow.ipol[port] = value;
+	
+	WriteRegister(&mcp23017, MCP23017_REGISTER(mcp23017.bank, MCP23017_INDEX_IPOL, port), value, MCP23017_CLASS_IPOL);
+}
+
+/***************************************************************************
+  Function:		BYTE ReadPortDirection(MCP23017_Port port)
+  Description:	Reads the input polarity register.
+  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
+  Returns:		Byte that was read.
+***************************************************************************/
+BYTE ReadPortPolarityReg(MCP23017_Port port)
+{
+	return ReadRegister(&mcp23017, MCP23017_REGISTER(mcp23017.bank, MCP23017_INDEX_IPOL, port), MCP23017_CLASS_IPOL);
+}
+
+/***************************************************************************
+  Function:		SetIntOnChange(MCP23017_Port port, BYTE value)
+  Description:	Sets the interrupt-on-change register, if a bit is set the
+				corresponding pin is enabled for interrupt-on-change.
+  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
+				BYTE value				:	The value to set.
+  Returns:		Nothing
+***************************************************************************/
+void SetIntOnChangeReg(MCP23017_Port port, BYTE value)
+{
+	mcp23017.shadow.gpinten[port] = value;
+	
+	WriteRegister(&mcp23017, MCP23017_REGISTER(mcp23017.bank, MCP23017_INDEX_GPINTEN, port), value, MCP23017_CLASS_GPINTEN);
+}
+
+/***************************************************************************
+  Function:		BYTE ReadIntOnChange(MCP23017_Port port)
+  Description:	Reads the interrupt-on-change register.
+  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
+  Returns:		Byte that was read.
+***************************************************************************/
+BYTE ReadIntOnChangeReg(MCP23017_Port port)
+{
+	return ReadRegister(&mcp23017, MCP23017_REGISTER(mcp23017.bank, MCP23017_INDEX_GPINTEN, port), MCP23017_CLASS_GPINTEN);
+}
+
+/***************************************************************************
+  Function:		SetDefaultCompareReg(MCP23017_Port port, BYTE value)
+  Description:	Sets the default compare register, these bits set the compare value
+				for pins configured for interrupt-on-change, if the associated pin
+				level is the opposite from the register bit, an interrupt occurs.
+  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
+				BYTE value				:	The value to set.
+  Returns:		Nothing
+***************************************************************************/
+void SetDefaultCompareReg(MCP23017_Port port, BYTE value)
+{
+	mcp23017.shadow.defval[port] = value;
+	
+	WriteRegister(&mcp23017, MCP23017_REGISTER(mcp23017.bank, MCP23017_INDEX_DEFVAL, port), value, MCP23017_CLASS_DEFVAL);
+}
+
+/***************************************************************************
+  Function:		BYTE ReadDefaultCompareReg(MCP23017_Port port)
+  Description:	Reads the default compare register for interrupt-on-change.
+  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
+  Returns:		Byte that was read.
+***************************************************************************/
+BYTE ReadDefaultCompareReg(MCP23017_Port port)
+{
+	return ReadRegister(&mcp23017, MCP23017_REGISTER(mcp23017.bank, MCP23017_INDEX_DEFVAL, port), MCP23017_CLASS_DEFVAL);
+}
+
+/***************************************************************************
+  Function:		SetIntControlReg(MCP23017_Port port, BYTE value)
+  Description:	Sets the interrupt control register, this register controls how the associated
+				pin value is compared for the interrupt-on-change.
+				If a bit is set, the corresponding IO pin is compared against the
+				associated bit in the DEFVAL register.
+				If a bit value is clear, the corresponding IO pin is compared against the previous value.
+  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
+				BYTE value				:	The value to set.
+  Returns:		Nothing
+***************************************************************************/
+void SetIntControlReg(MCP23017_Port port, BYTE value)
+{
+	mcp23017.shadow.intcon[port] = value;
+	
+	WriteRegister(&mcp23017, MCP23017_REGISTER(mcp23017.bank, MCP23017_INDEX_INTCON, port), value, MCP23017_CLASS_INTCON);
+}
+
+/***************************************************************************
+  Function:		BYTE ReadIntControlReg(MCP23017_Port port)
+  Description:	Reads the interrupt control register.
+  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
+  Returns:		Byte that was read.
+***************************************************************************/
+BYTE ReadIntControlReg(MCP23017_Port port)
+{
+	return ReadRegister(&mcp23017, MCP23017_REGISTER(mcp23017.bank, MCP23017_INDEX_INTCON, port), MCP23017_CLASS_INTCON);
+}
+
+/***************************************************************************
+  Function:		SetIoConfigReg(MCP23017_Port port, BYTE value)
+  Description:	Sets the IO Expander Configuration register, this register contains settings
+				that determine how the IO Expander behaves. IOCONA and IOCONB are the
+				same register, the BANK bit also switches the driver's address map.
+  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
+				BYTE value				:	The value to set.
+  Returns:		Nothing
+***************************************************************************/
+void SetIoConfigReg(MCP23017_Port port, BYTE value)
+{
+	/* IOCONA and IOCONB are the same register, a change of the BANK bit switches the address map */
+	WriteIoConfig(&mcp23017, value);
+}
+
+/***************************************************************************
+  Function:		BYTE ReadIntControlReg(MCP23017_Port port)
+  Description:	Reads the IO Expander Configuration register.
+  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
+  Returns:		Byte that was read.
+***************************************************************************/
+BYTE ReadIoConfigReg(MCP23017_Port port)
+{
+	return ReadRegister(&mcp23017, MCP23017_REGISTER(mcp23017.bank, MCP23017_INDEX_IOCON, port), MCP23017_CLASS_IOCON);
+}
+
+/***************************************************************************
+  Function:		SetPullupConfigReg(MCP23017_Port port, BYTE value)
+  Description:	Sets the pull-up resistor configuration register, if a bit is set
+				and the corresponding pin is configured as an input the corresponding
+				port pin is internally pulled up with a 100 kOhm resistor.
+  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
+				BYTE value				:	The value to set.
+  Returns:		Nothing
+***************************************************************************/
+void SetPullupConfigReg(MCP23017_Port port, BYTE value)
+{
+	mcp23017.shadow.gppu[port] = value;
+	
+	WriteRegister(&mcp23017, MCP23017_REGISTER(mcp23017.bank, MCP23017_INDEX_GPPU, port), value, MCP23017_CLASS_GPPU);
+}
+
+/***************************************************************************
+  Function:		BYTE ReadPullupConfigReg(MCP23017_Port port)
+  Description:	Reads pull-up configuration register.
+  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
+  Returns:		Byte that was read.
+***************************************************************************/
+BYTE ReadPullupConfigReg(MCP23017_Port port)
+{
+	return ReadRegister(&mcp23017, MCP23017_REGISTER(mcp23017.bank, MCP23017_INDEX_GPPU, port), MCP23017_CLASS_GPPU);
+}
+
+/***************************************************************************
+*  Function:		BYTE ReadInterruptFlagReg(MCP23017_Port port)
+*  Description:		The INTF register reflects the interrupt condition on the
+*					port pins of any pin that is enabled for interrupts via the
+*					GPINTEN register. A set bit indicates that the
+*					associated pin caused the interrupt.
+*					This is a read-only register.
+*  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
+*  Returns:			Byte that was read.
+***************************************************************************/
+BYTE ReadInterruptFlagReg(MCP23017_Port port)
+{
+	return ReadRegister(&mcp23017, MCP23017_REGISTER(mcp23017.bank, MCP23017_INDEX_INTF, port), MCP23017_CLASS_INTF);
+}
+
+/***************************************************************************
+*  Function:		BYTE ReadInterruptCaptureReg(MCP23017_Port port)
+*  Description:		The INTCAP register captures the GPIO port value at
+*					the time the interrupt occurred. The register is read
+*					only and is updated only when an interrupt occurs. The
+*					register will remain unchanged until the interrupt is
+*					cleared via a read of INTCAP or GPIO.
+*  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
+*  Returns:			Byte that was read.
+***************************************************************************/
+BYTE ReadInterruptCaptureReg(MCP23017_Port port)
+{
+	return ReadRegister(&mcp23017, MCP23017_REGISTER(mcp23017.bank, MCP23017_INDEX_INTCAP, port), MCP23017_CLASS_INTCAP);
+}
+
+/***************************************************************************
+*  Function:		SetPortReg(MCP23017_Port port, BYTE value)
+*  Description:		The GPIO register reflects the value on the port.
+*					Reading from this register reads the port. Writing to this
+*					register modifies the Output Latch (OLAT) register.
+*  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
+*					BYTE value				:	The value to set.
+*  Returns:			Nothing
+***************************************************************************/
+void SetPortReg(MCP23017_Port port, BYTE value)
+{
+	/* Writing the port register modifies the output latch */
+	mcp23017.shadow.olat[port] = value;
+	
+	WriteRegister(&mcp23017, MCP23017_REGISTER(mcp23017.bank, MCP23017_INDEX_GPIO, port), value, MCP23017_CLASS_GPIO);
+}
+/***************************************************************************
+*  Function:		BYTE ReadPortReg(MCP23017_Port port)
+*  Description:		The GPIO register reflects the value on the port.
+*					Reading from this register reads the port. Writing to this
+*					register modifies the Output Latch (OLAT) register.
+*  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
+*  Returns:			Byte that was read.
+***************************************************************************/
+BYTE ReadPortReg(MCP23017_Port port)
+{
+	return ReadRegister(&mcp23017, MCP23017_REGISTER(mcp23017.bank, MCP23017_INDEX_GPIO, port), MCP23017_CLASS_GPIO);
+}
+
+/***************************************************************************
+*  Function:		SetOutputLatchReg(MCP23017_Port port, BYTE value)
+*  Description:		The OLAT register provides access to the output
+*					latches. A read from this register results in a read of the
+*					OLAT and not the port itself. A write to this register
+*					modifies the output latches that modifies the pins
+*					configured as outputs.
+*  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
+*					BYTE value				:	The value to set.
+*  Returns:			Nothing
+***************************************************************************/
+void SetOutputLatchReg(MCP23017_Port port, BYTE value)
+{
+	mcp23017.shadow.olat[port] = value;
+	
+	WriteRegister(&mcp23017, MCP23017_REGISTER(mcp23017.bank, MCP23017_INDEX_OLAT, port), value, MCP23017_CLASS_OLAT);
+}
+/***************************************************************************
+*  Function:		BYTE ReadOutputLatchReg(MCP23017_Port port)
+*  Description:		The OLAT register provides access to the output
+*					latches. A read from this register results in a read of the
+*					OLAT and not the port itself. A write to this register
+*					modifies the output latches that modifies the pins
+*					configured as outputs.
+*  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
+*  Returns:			Byte that was read.
+***************************************************************************/
+BYTE ReadOutputLatchReg(MCP23017_Port port)
+{
+	return ReadRegister(&mcp23017, MCP23017_REGISTER(mcp23017.bank, MCP23017_INDEX_OLAT, port), MCP23017_CLASS_OLAT);
+}
+
+/***************************************************************************
+*  Function:		BYTE ApplyInputProfile(struct MCP23017* device, const BYTE* profile)
+*  Description:		Writes IODIR up to GPPU (including IOCON) in one sequential burst of
+*					14 registers, about 0.4 ms at 400 kHz instead of 10 single register
+*					writes (about 0.7 ms plus the driver round trips). The burst is done
+*					in BANK0, when the profile selects BANK1 or byte mode IOCON is
+*					written afterwards.
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					const BYTE* profile			:	MCP23017_PROFILE_LENGTH bytes built with
+*													MCP23017_INPUT_PROFILE.
+*  Returns:			The status of the burst (TWI_STATUS_...).
+***************************************************************************/
+BYTE ApplyInputProfile(struct MCP23017* device, const BYTE* profile)
+{
+	BYTE burst[MCP23017_PROFILE_LENGTH];
+	BYTE iocon = profile[MCP23017_IOCONA];
+	BYTE status;
+	
+	/* The address map must not change during the burst */
+	memcpy(burst, profile, sizeof(burst));
+	burst[MCP23017_IOCONA] = iocon & ~(MCP23017_BANK | MCP23017_SEQOP);
+	burst[MCP23017_IOCONB] = burst[MCP23017_IOCONA];
+	
+	SwitchBank(device, BANK0);
+	status = WriteIoExpanderBurst(device, MCP23017_IODIRA, burst, sizeof(burst));
+	
+	if(status == TWI_STATUS_DONE && iocon != burst[MCP23017_IOCONA])
+	{
+		WriteIoConfig(device, iocon);
+	}
+	
+	return status;
+}
+
+/***************************************************************************
+*  Function:		SnapshotIoExpander(struct MCP23017* device, union MCP23017Registers* config)
+*  Description:		Copies the configuration of the IO Expander from the register shadow,
+*					no bus transaction is needed. The blob can be stored in EEPROM or
+*					flash and passed to RestoreIoExpander() after a reset of the chip.
+*  Receives:		struct MCP23017* device				:	The IO Expander.
+*					union MCP23017Registers* config		:	Receives the configuration.
+*  Returns:			Nothing
+***************************************************************************/
+void SnapshotIoExpander(struct MCP23017* device, union MCP23017Registers* config)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		*config = device->shadow;
+	}
+	
+	/* Writing the port registers during the restore modifies the output latches, so keep them equal */
+	config->gpio[MCP23017_PORTA] = config->olat[MCP23017_PORTA];
+	config->gpio[MCP23017_PORTB] = config->olat[MCP23017_PORTB];
+	
+	/* Read-only registers */
+	config->intf[MCP23017_PORTA] = 0;
+	config->intf[MCP23017_PORTB] = 0;
+	config->intcap[MCP23017_PORTA] = 0;
+	config->intcap[MCP23017_PORTB] = 0;
+}
+
+/***************************************************************************
+*  Function:		BOOL RestoreIoExpander(struct MCP23017* device, const union MCP23017Registers* config)
+*  Description:		Writes a complete configuration in one sequential burst and verifies
+*					it by reading IODIR..GPPU and OLAT back like DumpRegisters(), INTCAP
+*					and GPIO are not read. The burst is done in BANK0 with sequential
+*					operation enabled (the power-on state), if the configuration uses
+*					BANK1 or disables sequential operation IOCON is written afterwards.
+*					When the driver's view of IOCON is not the default one IOCON is
+*					cleared first, this write is harmless when the chip was reset
+*					(the collateral register is overwritten by the burst).
+*  Receives:		struct MCP23017* device				:	The IO Expander.
+*					const union MCP23017Registers* config	:	The configuration to restore.
+*  Returns:			TRUE when the configuration was written and verified.
+***************************************************************************/
+BOOL RestoreIoExpander(struct MCP23017* device, const union MCP23017Registers* config)
+{
+	union MCP23017Registers burst = *config;
+	union MCP23017Registers readBack;
+	BYTE iocon = config->iocon[MCP23017_PORTA];
+	BOOL restored = TRUE;
+	BYTE i;
+	
+	/* The address map must not change during the burst */
+	burst.iocon[MCP23017_PORTA] = iocon & ~(MCP23017_BANK | MCP23017_SEQOP);
+	burst.iocon[MCP23017_PORTB] = burst.iocon[MCP23017_PORTA];
+	burst.gpio[MCP23017_PORTA] = config->olat[MCP23017_PORTA];
+	burst.gpio[MCP23017_PORTB] = config->olat[MCP23017_PORTB];
+	
+	if(device->shadow.iocon[MCP23017_PORTA] & (MCP23017_BANK | MCP23017_SEQOP))
+	{
+		WriteIoConfig(device, 0x00);
+	}
+	
+	/* INTCAP and GPIO are not read back, that would clear an interrupt-on-change which is already enabled */
+	if(WriteRegisters(device, MCP23017_IODIRA, burst.raw, MCP23017_REGISTER_COUNT, MCP23017_CLASS_BURST) != TWI_STATUS_DONE ||
+	   ReadRegisters(device, MCP23017_IODIRA, readBack.raw, MCP23017_GPPUB - MCP23017_IODIRA + 1, MCP23017_CLASS_BURST) != TWI_STATUS_DONE ||
+	   ReadRegisters(device, MCP23017_OLATA, readBack.olat, sizeof(readBack.olat), MCP23017_CLASS_BURST) != TWI_STATUS_DONE)
+	{
+		return FALSE;
+	}
+	
+	/* The flag, capture and port registers reflect the pins and are not compared */
+	for(i = 0; i < MCP23017_REGISTER_COUNT; i++)
+	{
+		if(i < MCP23017_INTFA || i > MCP23017_GPIOB)
+		{
+			restored &= (readBack.raw[i] == burst.raw[i]);
+		}
+	}
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		device->shadow = burst;
+	}
+	
+	if(iocon != burst.iocon[MCP23017_PORTA])
+	{
+		WriteIoConfig(device, iocon);
+	}
+	
+	return restored;
+}
+
+/***************************************************************************
+*  Function:		StartRestoreIoExpander(struct MCP23017RestoreTask* task, struct MCP23017* device,
+*											   const union MCP23017Registers* config)
+*  Description:		Prepares a restore without blocking, RestoreIoExpanderTask() then does
+*					the transactions of RestoreIoExpander() from the main loop.
+*  Receives:		struct MCP23017RestoreTask* task			:	The task state.
+*					struct MCP23017* device					:	The IO Expander.
+*					const union MCP23017Registers* config	:	The configuration, must stay valid while the task runs.
+*  Returns:			Nothing
+***************************************************************************/
+void StartRestoreIoExpander(struct MCP23017RestoreTask* task, struct MCP23017* device, const union MCP23017Registers* config)
+{
+	ASYNC_INIT(&task->context);
+	task->device = device;
+	task->config = config;
+	task->request.callback = NULL;
+	task->request.deadline = 0;
+	task->restored = FALSE;
+}
+
+/***************************************************************************
+*  Function:		BYTE RestoreIoExpanderTask(struct MCP23017RestoreTask* task)
+*  Description:		Task (see async.h) which restores a configuration like
+*					RestoreIoExpander(): IOCON is cleared when needed, the configuration
+*					is written and read back (IODIR..GPPU and OLAT) in sequential bursts
+*					and IOCON is written
+*					last. Call it from the main loop until it returns ASYNC_DONE, the
+*					result is then in task->restored. The IOCON writes wait for an idle
+*					bus (see SubmitIoConfig).
+*  Receives:		struct MCP23017RestoreTask* task	:	The task state, from StartRestoreIoExpander().
+*  Returns:			ASYNC_WAITING while the restore runs, ASYNC_DONE when it is finished.
+***************************************************************************/
+BYTE RestoreIoExpanderTask(struct MCP23017RestoreTask* task)
+{
+	struct MCP23017* device = task->device;
+	BYTE i;
+	
+	ASYNC_BEGIN(&task->context);
+	
+	/* The address map must not change during the burst */
+	task->burst = *task->config;
+	task->burst.iocon[MCP23017_PORTA] = task->config->iocon[MCP23017_PORTA] & ~(MCP23017_BANK | MCP23017_SEQOP);
+	task->burst.iocon[MCP23017_PORTB] = task->burst.iocon[MCP23017_PORTA];
+	task->burst.gpio[MCP23017_PORTA] = task->config->olat[MCP23017_PORTA];
+	task->burst.gpio[MCP23017_PORTB] = task->config->olat[MCP23017_PORTB];
+	
+	if(device->shadow.iocon[MCP23017_PORTA] & (MCP23017_BANK | MCP23017_SEQOP))
+	{
+		ASYNC_WAIT_UNTIL(&task->context, SubmitIoConfig(device, &task->request, 0x00));
+		ASYNC_AWAIT(&task->context, &task->request);
+	}
+	
+	ASYNC_WAIT_UNTIL(&task->context, SubmitBurst(device, &task->request, MCP23017_IODIRA, TWI_WRITE, task->burst.raw, MCP23017_REGISTER_COUNT));
+	ASYNC_AWAIT(&task->context, &task->request);
+	
+	/* INTCAP and GPIO are not read back, that would clear an interrupt-on-change which is already enabled */
+	if(task->request.status == TWI_STATUS_DONE)
+	{
+		ASYNC_WAIT_UNTIL(&task->context, SubmitBurst(device, &task->request, MCP23017_IODIRA, TWI_READ, task->readBack.raw,
+													 MCP23017_GPPUB - MCP23017_IODIRA + 1));
+		ASYNC_AWAIT(&task->context, &task->request);
+	}
+	
+	if(task->request.status == TWI_STATUS_DONE)
+	{
+		ASYNC_WAIT_UNTIL(&task->context, SubmitBurst(device, &task->request, MCP23017_OLATA, TWI_READ, task->readBack.olat,
+													 sizeof(task->readBack.olat)));
+		ASYNC_AWAIT(&task->context, &task->request);
+	}
+	
+	if(task->request.status == TWI_STATUS_DONE)
+	{
+		/* The flag, capture and port registers reflect the pins and are not compared */
+		task->restored = TRUE;
+		
+		for(i = 0; i < MCP23017_REGISTER_COUNT; i++)
 		{
-			byteRead = twi_read1byte(address, MCP23017_IOCONA);
+			if(i < MCP23017_INTFA || i > MCP23017_GPIOB)
+			{
+				task->restored &= (task->readBack.raw[i] == task->burst.raw[i]);
+			}
 		}
-		else if(port == MCP23017_PORTB)
+		
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 		{
-			byteRead = twi_read1byte(address, MCP23017_IOCONB);
+			device->shadow = task->burst;
 		}
+		
+		if(task->config->iocon[MCP23017_PORTA] != task->burst.iocon[MCP23017_PORTA])
+		{
+			ASYNC_WAIT_UNTIL(&task->context, SubmitIoConfig(device, &task->request, task->config->iocon[MCP23017_PORTA]));
+			ASYNC_AWAIT(&task->context, &task->request);
+		}
+	}
+	
+	ASYNC_END(&task->context);
+}
+
+/***************************************************************************
+*  Function:		BOOL IsIoExpanderConfigured(struct MCP23017* device)
+*  Description:		Cheap check if the IO Expander still has its configuration, a silent
+*					reset (brown-out) is detected by comparing IOCON and IODIR with the
+*					shadow. After a reset IOCON reads 0x00 and IODIR reads 0xFF, so a
+*					configuration which uses exactly these values can not be checked.
+*					IOCON is read first, when it differs no further transaction is done.
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*  Returns:			TRUE when the configuration matches, FALSE otherwise or when the
+*					device does not respond.
+*  Note(s):			Not to be called while RestoreIoExpander() is running.
+***************************************************************************/
+BOOL IsIoExpanderConfigured(struct MCP23017* device)
+{
+	BYTE value;
+	
+	if(ReadRegisters(device, GetRegisterAddress(device->bank, MCP23017_IOCON), &value, 1, MCP23017_CLASS_IOCON) != TWI_STATUS_DONE ||
+	   value != device->shadow.iocon[MCP23017_PORTA])
+	{
+		return FALSE;
+	}
+	
+	if(ReadRegisters(device, GetRegisterAddress(device->bank, MCP23017_IODIRA), &value, 1, MCP23017_CLASS_IODIR) != TWI_STATUS_DONE ||
+	   value != device->shadow.iodir[MCP23017_PORTA])
+	{
+		return FALSE;
+	}
+	
+	if(ReadRegisters(device, GetRegisterAddress(device->bank, MCP23017_IODIRB), &value, 1, MCP23017_CLASS_IODIR) != TWI_STATUS_DONE ||
+	   value != device->shadow.iodir[MCP23017_PORTB])
+	{
+		return FALSE;
+	}
+	
+	return TRUE;
+}
+
+/***************************************************************************
+*  Function:		BOOL ProbeIoExpander(struct MCP23017* device)
+*  Description:		Checks if the IO Expander acknowledges its address, the transaction
+*					is only START, address and STOP (2 bytes of bus time with the
+*					multiplexer channel already selected, about 25 us at 400 kHz).
+*					No register is touched.
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*  Returns:			TRUE when the device responds.
+***************************************************************************/
+BOOL ProbeIoExpander(struct MCP23017* device)
+{
+	struct TwiRequest request = { .address = device->address, .flags = TWI_WRITE | TWI_NO_REGISTER, .length = 0,
+								  .statisticsClass = MCP23017_CLASS_BURST, .mux = device->mux, .channel = device->channel,
+								  .priority = TWI_PRIORITY_DIAGNOSTIC };
+	
+	return (TwiTransfer(&request) == TWI_STATUS_DONE);
+}
+
+/***************************************************************************
+*  Function:		BOOL ProbeIoExpanderAsync(struct MCP23017* device, struct TwiRequest* request)
+*  Description:		Queues the address check of ProbeIoExpander() and returns directly.
+*					The device responds when the status of the request is TWI_STATUS_DONE,
+*					TWI_STATUS_ADDRESS_NACK when it does not.
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					struct TwiRequest* request	:	The request, owned by the TWI driver while pending.
+*  Returns:			TRUE when the probe was queued, FALSE when the queue is full (try again later).
+***************************************************************************/
+BOOL ProbeIoExpanderAsync(struct MCP23017* device, struct TwiRequest* request)
+{
+	PrepareRequest(device, request, MCP23017_IODIRA, TWI_WRITE | TWI_NO_REGISTER, NULL, 0);
+	request->statisticsClass = MCP23017_CLASS_BURST;
+	request->priority = TWI_PRIORITY_DIAGNOSTIC;
+	
+	return TwiSubmit(request);
+}
+
+/***************************************************************************
+*  Function:		BOOL DumpRegisters(struct MCP23017* device, union MCP23017Registers* registers)
+*  Description:		Reads the configuration registers (IODIR up to and including GPPU)
+*					and the output latches and stores them in BANK0 order, one
+*					sequential read for IODIR..GPPU and one for OLAT per bank map (per
+*					port in BANK1). INTF, INTCAP and GPIO are not read, reading INTCAP
+*					or GPIO would clear a pending interrupt-on-change which the
+*					interrupt handling then misses, they are 0 in the dump. At 400 kHz
+*					a BANK0 dump takes about 0.5 ms of bus time.
+*					Sequential operation is enabled when needed.
+*  Receives:		struct MCP23017* device				:	The IO Expander.
+*					union MCP23017Registers* registers	:	Receives the register values.
+*  Returns:			TRUE when the registers were read.
+***************************************************************************/
+BOOL DumpRegisters(struct MCP23017* device, union MCP23017Registers* registers)
+{
+	BYTE block[MCP23017_INDEX_GPPU + 1];
+	BYTE port;
+	BYTE i;
+	
+	SetSequentialOperation(device, TRUE);
+	memset(registers, 0, sizeof(*registers));
+	
+	if(device->bank == BANK0)
+	{
+		return (ReadRegisters(device, MCP23017_IODIRA, registers->raw, MCP23017_GPPUB - MCP23017_IODIRA + 1, MCP23017_CLASS_BURST) == TWI_STATUS_DONE &&
+				ReadRegisters(device, MCP23017_OLATA, registers->olat, sizeof(registers->olat), MCP23017_CLASS_BURST) == TWI_STATUS_DONE);
+	}
+	
+	/* In BANK1 the registers of each port are grouped, interleave them to BANK0 order */
+	for(port = MCP23017_PORTA; port <= MCP23017_PORTB; port++)
+	{
+		if(ReadRegisters(device, MCP23017_REGISTER_BANK1(MCP23017_INDEX_IODIR, port), block, sizeof(block),
+						 MCP23017_CLASS_BURST) != TWI_STATUS_DONE ||
+		   ReadRegisters(device, MCP23017_REGISTER_BANK1(MCP23017_INDEX_OLAT, port), &registers->olat[port], 1,
+						 MCP23017_CLASS_BURST) != TWI_STATUS_DONE)
+		{
+			return FALSE;
+		}
+		
+		for(i = 0; i < sizeof(block); i++)
+		{
+			registers->raw[MCP23017_REGISTER_BANK0(i, port)] = block[i];
+		}
+	}
+	
+	return TRUE;
+}
+
+/***************************************************************************
+*  Function:		PrepareDumpRead(struct MCP23017* device, struct TwiRequest* request, BYTE reg,
+*									BYTE* buffer, BYTE length, struct TwiRequest* next)
+*  Description:		Fills a link of the chain of DumpRegistersAsync().
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					struct TwiRequest* request	:	The link.
+*					BYTE reg					:	The first register in BANK0.
+*					BYTE* buffer				:	Receives the values.
+*					BYTE length					:	The number of registers.
+*					struct TwiRequest* next		:	The next link, NULL for the last one.
+*  Returns:			Nothing
+***************************************************************************/
+static void PrepareDumpRead(struct MCP23017* device, struct TwiRequest* request, BYTE reg, BYTE* buffer, BYTE length, struct TwiRequest* next)
+{
+	PrepareRequest(device, request, reg, TWI_READ, buffer, length);
+	request->statisticsClass = MCP23017_CLASS_BURST;
+	request->priority = TWI_PRIORITY_DIAGNOSTIC;
+	request->deadline = 0;
+	request->callback = NULL;
+	request->next = next;
+}
+
+/***************************************************************************
+*  Function:		DumpInterleave(struct TwiRequest* request)
+*  Description:		Completion of a BANK1 dump, called from the TWI interrupt. The
+*					IODIR..GPPU blocks of PORTA and PORTB were read one after the other
+*					and are interleaved to BANK0 order in place.
+*  Receives:		struct TwiRequest* request	:	The last link, it read OLATB.
+*  Returns:			Nothing
+***************************************************************************/
+static void DumpInterleave(struct TwiRequest* request)
+{
+	BYTE* raw = request->buffer - MCP23017_OLATB;
+	BYTE block[2][MCP23017_INDEX_GPPU + 1];
+	BYTE port;
+	BYTE i;
+	
+	if(request->status != TWI_STATUS_DONE)
+	{
+		return;
+	}
+	
+	memcpy(block, raw, sizeof(block));
+	
+	for(port = MCP23017_PORTA; port <= MCP23017_PORTB; port++)
+	{
+		for(i = 0; i < sizeof(block[0]); i++)
+		{
+			raw[MCP23017_REGISTER_BANK0(i, port)] = block[port][i];
+		}
+	}
+}
+
+/***************************************************************************
+*  Function:		BOOL DumpRegistersAsync(struct MCP23017* device, struct TwiRequest* requests,
+*											union MCP23017Registers* registers)
+*  Description:		Queues the reads of DumpRegisters() as one chain and returns directly.
+*					The dump is finished when the status of the last request
+*					(requests[MCP23017_DUMP_REQUESTS - 1]) is no longer pending and valid
+*					when it is TWI_STATUS_DONE (TwiWait(requests) waits for it), in BANK0
+*					only the last two requests are used. The driver sets the callbacks
+*					and deadlines of the requests.
+*					Unlike DumpRegisters() the chain is not split, it keeps the bus for
+*					about 0.5 ms at 400 kHz. Requires sequential operation (IOCON.SEQOP
+*					cleared).
+*  Receives:		struct MCP23017* device				:	The IO Expander.
+*					struct TwiRequest* requests			:	MCP23017_DUMP_REQUESTS requests, owned by the TWI driver while pending.
+*					union MCP23017Registers* registers	:	Receives the register values, written by the TWI interrupt.
+*  Returns:			TRUE when the dump was queued, FALSE when the queue is full (try again later).
+***************************************************************************/
+BOOL DumpRegistersAsync(struct MCP23017* device, struct TwiRequest* requests, union MCP23017Registers* registers)
+{
+	struct TwiRequest* last = &requests[MCP23017_DUMP_REQUESTS - 1];
+	
+	memset(registers, 0, sizeof(*registers));
+	
+	if(device->bank == BANK0)
+	{
+		/* The unused requests lead to the chain, so TwiWait(requests) works in both banks */
+		requests[0].status = TWI_STATUS_DONE;
+		requests[0].next = &requests[1];
+		requests[1].status = TWI_STATUS_DONE;
+		requests[1].next = &requests[2];
+		PrepareDumpRead(device, &requests[2], MCP23017_IODIRA, registers->raw, MCP23017_GPPUB - MCP23017_IODIRA + 1, last);
+		PrepareDumpRead(device, last, MCP23017_OLATA, registers->olat, sizeof(registers->olat), NULL);
+		
+		return TwiSubmit(&requests[2]);
+	}
+	
+	/* In BANK1 the blocks are read to raw[0..13] and interleaved when the chain is finished */
+	PrepareDumpRead(device, &requests[0], MCP23017_IODIRA, registers->raw, MCP23017_INDEX_GPPU + 1, &requests[1]);
+	PrepareDumpRead(device, &requests[1], MCP23017_OLATA, &registers->olat[MCP23017_PORTA], 1, &requests[2]);
+	PrepareDumpRead(device, &requests[2], MCP23017_IODIRB, &registers->raw[MCP23017_INDEX_GPPU + 1], MCP23017_INDEX_GPPU + 1, last);
+	PrepareDumpRead(device, last, MCP23017_OLATB, &registers->olat[MCP23017_PORTB], 1, NULL);
+	last->callback = DumpInterleave;
+	
+	return TwiSubmit(requests);
+}
+
+/***************************************************************************
+*  Function:		BYTE DiffRegisters(struct MCP23017* device, const union MCP23017Registers* registers,
+*									   union MCP23017Registers* drift)
+*  Description:		Compares a dump with the register shadow, a set bit in the drift
+*					map is a bit which differs from the value the driver wrote (for example
+*					flipped by ESD). The flag, capture and port registers are not dumped
+*					and are always reported as 0.
+*  Receives:		struct MCP23017* device					:	The IO Expander.
+*					const union MCP23017Registers* registers	:	Dump from DumpRegisters().
+*					union MCP23017Registers* drift			:	Receives the drifted bits.
+*  Returns:			The number of registers which drifted, 0 when the device is as expected.
+***************************************************************************/
+BYTE DiffRegisters(struct MCP23017* device, const union MCP23017Registers* registers, union MCP23017Registers* drift)
+{
+	BYTE drifted = 0;
+	BYTE i;
+	
+	for(i = 0; i < MCP23017_REGISTER_COUNT; i++)
+	{
+		if(i >= MCP23017_INTFA && i <= MCP23017_GPIOB)
+		{
+			drift->raw[i] = 0;
+		}
+		else
+		{
+			drift->raw[i] = registers->raw[i] ^ device->shadow.raw[i];
+		}
+		
+		if(drift->raw[i] != 0)
+		{
+			drifted++;
+		}
+	}
+	
+	return drifted;
+}
+
+/***************************************************************************
+*  Function:		BYTE StreamReadPort(struct MCP23017* device, MCP23017_Port port, BYTE* samples, BYTE count)
+*  Description:		Samples the GPIO register count times in a single transaction
+*					(one START), sequential operation is disabled for this and left
+*					disabled so following streams do not need an IOCON write.
+*					In BANK1 every sample is the requested port, in BANK0 the pointer
+*					toggles within the A/B pair: even samples are the requested port and
+*					odd samples the other port (paired 16-bit capture).
+*					At 400 kHz every sample takes 9 SCL clocks, about 44000 samples/s
+*					(calculated, the TWI interrupt between bytes lowers this slightly).
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					MCP23017_Port port			:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
+*					BYTE* samples				:	Receives the samples, written directly by the TWI interrupt.
+*					BYTE count					:	The number of samples, at least 1.
+*  Returns:			The status of the transaction (TWI_STATUS_...).
+***************************************************************************/
+BYTE StreamReadPort(struct MCP23017* device, MCP23017_Port port, BYTE* samples, BYTE count)
+{
+	SetSequentialOperation(device, FALSE);
+	
+	return ReadRegisters(device, GetRegisterAddress(device->bank, MCP23017_GPIOA + port), samples, count, MCP23017_CLASS_GPIO);
+}
+
+/***************************************************************************
+*  Function:		UpdateStreamShadow(struct MCP23017* device, MCP23017_Port port, const BYTE* patterns, BYTE count)
+*  Description:		Updates the output latches of the shadow for a stream of patterns.
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					MCP23017_Port port			:	The port of the first pattern.
+*					const BYTE* patterns		:	The patterns.
+*					BYTE count					:	The number of patterns, at least 1.
+*  Returns:			Nothing
+***************************************************************************/
+static void UpdateStreamShadow(struct MCP23017* device, MCP23017_Port port, const BYTE* patterns, BYTE count)
+{
+	/* The output latches follow the last pattern written to each port */
+	if(device->bank == BANK1 || count == 1)
+	{
+		device->shadow.olat[port] = patterns[count - 1];
 	}
-	else if(BankInUse == BANK1)
+	else
 	{
-		if(port == MCP23017_PORTA)
-		{
-			byteRead = twi_read1byte(address, MCP23017_IOCONA_BANK1);
-		}
-		else if(port == MCP23017_PORTB)
-		{
-			byteRead = twi_read1byte(address, MCP23017_IOCONB_BANK1);
-		}
+		device->shadow.olat[port] = patterns[(count - 1) & ~1];
+		device->shadow.olat[port ^ 1] = patterns[((count - 2) | 1)];
 	}
+}
+
+/***************************************************************************
+*  Function:		BYTE StreamWritePort(struct MCP23017* device, MCP23017_Port port, const BYTE* patterns, BYTE count)
+*  Description:		Writes a sequence of output patterns to the output latch in a
+*					single transaction, sequential operation is disabled for this and
+*					left disabled. In BANK1 every pattern goes to the requested port, in
+*					BANK0 the patterns alternate between the requested and the other port.
+*					The pace is the bus rate, about 44000 patterns/s at 400 kHz.
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					MCP23017_Port port			:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
+*					const BYTE* patterns		:	The patterns, read directly by the TWI interrupt.
+*					BYTE count					:	The number of patterns, at least 1.
+*  Returns:			The status of the transaction (TWI_STATUS_...).
+***************************************************************************/
+BYTE StreamWritePort(struct MCP23017* device, MCP23017_Port port, const BYTE* patterns, BYTE count)
+{
+	SetSequentialOperation(device, FALSE);
+	UpdateStreamShadow(device, port, patterns, count);
 	
-	return byteRead;
+	return WriteRegisters(device, GetRegisterAddress(device->bank, MCP23017_OLATA + port), patterns, count, MCP23017_CLASS_OLAT);
 }
 
 /***************************************************************************
-  Function:		SetPullupConfigReg(MCP23017_Port port, BYTE value)
-  Description:	Sets the pull-up resistor configuration register, if a bit is set
-				and the corresponding pin is configured as an input the corresponding
-				port pin is internally pulled up with a 100 kOhm resistor.
-  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
-				BYTE value				:	The value to set.
-  Returns:		Nothing
+*  Function:		BOOL StreamReadPortAsync(struct MCP23017* device, struct TwiRequest* request,
+*											 MCP23017_Port port, BYTE* samples, BYTE count)
+*  Description:		Queues the samples of StreamReadPort() and returns directly. The
+*					buffer belongs to the TWI driver until the status of the request is
+*					no longer pending. Requires sequential operation disabled (IOCON.SEQOP
+*					set, see SetSequentialOperationAsync).
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					struct TwiRequest* request	:	The request, owned by the TWI driver while pending.
+*					MCP23017_Port port			:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
+*					BYTE* samples				:	Receives the samples, written directly by the TWI interrupt.
+*					BYTE count					:	The number of samples, at least 1.
+*  Returns:			TRUE when the stream was queued, FALSE when the queue is full (try again later).
 ***************************************************************************/
-void SetPullupConfigReg(MCP23017_Port port, BYTE value)
+BOOL StreamReadPortAsync(struct MCP23017* device, struct TwiRequest* request, MCP23017_Port port, BYTE* samples, BYTE count)
 {
-	if(BankInUse == BANK0)
-	{
-		if(port == MCP23017_PORTA)
-		{
-			TwiSend(address, MCP23017_GPPUA, value);
-		}
-		else if(port == MCP23017_PORTB)
-		{
-			TwiSend(address, MCP23017_GPPUB, value);
-		}
-	}
-	else if(BankInUse == BANK1)
+	PrepareRequest(device, request, MCP23017_GPIOA + port, TWI_READ, samples, count);
+	
+	return TwiSubmit(request);
+}
+
+/***************************************************************************
+*  Function:		BOOL StreamWritePortAsync(struct MCP23017* device, struct TwiRequest* request,
+*											  MCP23017_Port port, const BYTE* patterns, BYTE count)
+*  Description:		Queues the patterns of StreamWritePort() and returns directly, the
+*					shadow is updated right away. The buffer belongs to the TWI driver
+*					until the status of the request is no longer pending. Requires
+*					sequential operation disabled (IOCON.SEQOP set, see
+*					SetSequentialOperationAsync).
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					struct TwiRequest* request	:	The request, owned by the TWI driver while pending.
+*					MCP23017_Port port			:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
+*					const BYTE* patterns		:	The patterns, must stay valid while pending.
+*					BYTE count					:	The number of patterns, at least 1.
+*  Returns:			TRUE when the stream was queued, FALSE when the queue is full (try again later).
+***************************************************************************/
+BOOL StreamWritePortAsync(struct MCP23017* device, struct TwiRequest* request, MCP23017_Port port, const BYTE* patterns, BYTE count)
+{
+	PrepareRequest(device, request, MCP23017_OLATA + port, TWI_WRITE, (BYTE*)patterns, count);
+	
+	if(!TwiSubmit(request))
 	{
-		if(port == MCP23017_PORTA)
-		{
-			TwiSend(address, MCP23017_GPPUA_BANK1, value);
-		}
-		else if(port == MCP23017_PORTB)
-		{
-			TwiSend(address, MCP23017_GPPUB_BANK1, value);
-		}
+		return FALSE;
 	}
+	
+	UpdateStreamShadow(device, port, patterns, count);
+	
+	return TRUE;
 }
 
 /***************************************************************************
-  Function:		BYTE ReadPullupConfigReg(MCP23017_Port port)
-  Description:	Reads pull-up configuration register.
-  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
-  Returns:		Byte that was read.
+*  Function:		BOOL IsInterruptActive(struct MCP23017* device, MCP23017_Port port)
+*  Description:		Reads the level of the INT line of a port. The line is active-high
+*					with IOCON.INTPOL on a push-pull output, otherwise active-low.
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					MCP23017_Port port			:	The port.
+*  Returns:			TRUE when the line is attached and active.
 ***************************************************************************/
-BYTE ReadPullupConfigReg(MCP23017_Port port)
+static BOOL IsInterruptActive(struct MCP23017* device, MCP23017_Port port)
 {
-	BYTE byteRead = 0;
+	BYTE level;
 	
-	if(BankInUse == BANK0)
+	if(device->interruptPins == NULL || device->interruptMask[port] == 0)
 	{
-		if(port == MCP23017_PORTA)
-		{
-			byteRead = twi_read1byte(address, MCP23017_GPPUA);
-		}
-		else if(port == MCP23017_PORTB)
-		{
-			byteRead = twi_read1byte(address, MCP23017_GPPUB);
-		}
+		return FALSE;
 	}
-	else if(BankInUse == BANK1)
+	
+	level = *device->interruptPins & device->interruptMask[port];
+	
+	if((device->shadow.iocon[MCP23017_PORTA] & (MCP23017_INTPOL | MCP23017_ODR)) == MCP23017_INTPOL)
 	{
-		if(port == MCP23017_PORTA)
-		{
-			byteRead = twi_read1byte(address, MCP23017_GPPUA_BANK1);
-		}
-		else if(port == MCP23017_PORTB)
-		{
-			byteRead = twi_read1byte(address, MCP23017_GPPUB_BANK1);
-		}
+		return (level != 0);
 	}
 	
-	return byteRead;
+	return (level == 0);
 }
 
 /***************************************************************************
-*  Function:		BYTE ReadInterruptFlagReg(MCP23017_Port port)
-*  Description:		The INTF register reflects the interrupt condition on the
-*					port pins of any pin that is enabled for interrupts via the
-*					GPINTEN register. A set bit indicates that the
-*					associated pin caused the interrupt.
-*					This is a read-only register.
-*  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
-*  Returns:			Byte that was read.
+*  Function:		SetInterruptPending(struct MCP23017* device, BYTE ports, uint32_t timestamp)
+*  Description:		Marks interrupts of ports as not read yet, the timestamp of the
+*					event is the one of the first unread interrupt. Called with
+*					interrupts disabled.
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					BYTE ports					:	Bit per port.
+*					uint32_t timestamp			:	Timer ticks of the interrupt.
+*  Returns:			Nothing
 ***************************************************************************/
-BYTE ReadInterruptFlagReg(MCP23017_Port port)
+static void SetInterruptPending(struct MCP23017* device, BYTE ports, uint32_t timestamp)
 {
-	BYTE byteRead = 0;
+	if(!(device->interruptPending & INTERRUPT_PORTS))
+	{
+		device->interruptTicks = timestamp;
+	}
 	
-	if(BankInUse == BANK0)
+	device->interruptPending |= ports;
+}
+
+/***************************************************************************
+*  Function:		AddWaitingDevice(struct MCP23017* device)
+*  Description:		Puts a device in the list of devices whose interrupt read still has
+*					to be queued, the INT line stays active until INTCAP is read.
+*					Called with interrupts disabled.
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*  Returns:			Nothing
+***************************************************************************/
+static void AddWaitingDevice(struct MCP23017* device)
+{
+	if(!(device->interruptPending & INTERRUPT_WAITING))
 	{
-		if(port == MCP23017_PORTA)
-		{
-			byteRead = i2c_read1byte(address, MCP23017_INTFA);
-		}
-		else if(port == MCP23017_PORTB)
-		{
-			byteRead = i2c_read1byte(address, MCP23017_INTFB);
-		}
+		device->interruptPending |= INTERRUPT_WAITING;
+		device->nextWaiting = waitingDevices;
+		waitingDevices = device;
 	}
-	else if(BankInUse == BANK1)
+}
+
+/***************************************************************************
+*  Function:		DeferInterruptRead(struct MCP23017* device)
+*  Description:		Puts a device whose interrupt read found no room back in the
+*					waiting list and counts the overflow. Called with interrupts disabled.
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*  Returns:			Nothing
+***************************************************************************/
+static void DeferInterruptRead(struct MCP23017* device)
+{
+	AddWaitingDevice(device);
+	eventOverflows++;
+}
+
+/* Completion callbacks of the interrupt read, they queue the next read */
+static void InterruptFlagsDone(struct TwiRequest* request);
+static void InterruptCaptureDone(struct TwiRequest* request);
+
+/***************************************************************************
+*  Function:		QueueInterruptRead(struct MCP23017* device)
+*  Description:		Reserves an event slot and queues the read of INTF and INTCAP
+*					as a chain, every request sends its own register address so the
+*					read does not depend on IOCON.SEQOP. In BANK0 each request reads
+*					an A/B pair (the pointer toggles within the pair in byte mode and
+*					increments in sequential mode), in BANK1 the pending port is read.
+*					The INTCAP read is trimmed to the flagged ports (InterruptFlagsDone).
+*					Without room the read is deferred. Called with interrupts disabled
+*					and no read of the device pending.
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*  Returns:			Nothing
+***************************************************************************/
+static void QueueInterruptRead(struct MCP23017* device)
+{
+	struct TwiRequest* flags = &device->interruptRequest[0];
+	struct TwiRequest* capture = &device->interruptRequest[1];
+	struct MCP23017Event* event;
+	BYTE pending = device->interruptPending;
+	MCP23017_Port port = (pending & (1 << MCP23017_PORTA)) ? MCP23017_PORTA : MCP23017_PORTB;
+	BYTE i;
+	
+	if((BYTE)(eventReserved - eventTail) >= MCP23017_EVENT_LOG_SIZE)
 	{
-		if(port == MCP23017_PORTA)
-		{
-			byteRead = i2c_read1byte(address, MCP23017_INTFA_BANK1);
-		}
-		else if(port == MCP23017_PORTB)
-		{
-			byteRead = i2c_read1byte(address, MCP23017_INTFB_BANK1);
-		}
+		DeferInterruptRead(device);
+		return;
+	}
+	
+	for(i = 0; i < 2; i++)
+	{
+		device->interruptRequest[i] = (struct TwiRequest){ .address = device->address, .mux = device->mux, .channel = device->channel,
+														   .flags = TWI_READ, .priority = TWI_PRIORITY_INTERRUPT,
+														   .statisticsClass = MCP23017_CLASS_INTF + i };
+	}
+	flags->next = capture;
+	flags->callback = InterruptFlagsDone;
+	capture->callback = InterruptCaptureDone;
+	
+	event = &eventLog[eventReserved & (MCP23017_EVENT_LOG_SIZE - 1)];
+	event->timestamp = device->interruptTicks;
+	event->device = device;
+	event->address = device->address;
+	
+	if(device->bank == BANK0)
+	{
+		/* INTFA, INTFB and INTCAPA, INTCAPB straight into the slot */
+		flags->reg = MCP23017_INTFA;
+		flags->buffer = event->intf;
+		flags->length = 2;
+		capture->reg = MCP23017_INTCAPA;
+		capture->buffer = event->intcap;
+		capture->length = 2;
+		device->interruptPending = pending & ~INTERRUPT_PORTS;
+	}
+	else
+	{
+		memset(event->intf, 0, sizeof(event->intf) + sizeof(event->intcap));
+		flags->reg = MCP23017_REGISTER_BANK1(MCP23017_INDEX_INTF, port);
+		flags->buffer = &device->interruptData[0];
+		flags->length = 1;
+		capture->reg = MCP23017_REGISTER_BANK1(MCP23017_INDEX_INTCAP, port);
+		capture->buffer = &device->interruptData[1];
+		capture->length = 1;
+		device->interruptPending = pending & ~(1 << port);
+	}
+	
+	device->interruptPort = port;
+	device->interruptSlot = eventReserved;
+	
+	if(!TwiSubmit(flags))
+	{
+		device->interruptPending = pending;
+		DeferInterruptRead(device);
+		return;
 	}
 	
-	return byteRead;
+	eventReserved++;
 }
 
 /***************************************************************************
-*  Function:		BYTE ReadInterruptCaptureReg(MCP23017_Port port)
-*  Description:		The INTCAP register captures the GPIO port value at
-*					the time the interrupt occurred. The register is read
-*					only and is updated only when an interrupt occurs. The
-*					register will remain unchanged until the interrupt is
-*					cleared via a read of INTCAP or GPIO.
-*  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
-*  Returns:			Byte that was read.
+*  Function:		BOOL QueueWaitingRead()
+*  Description:		Queues the interrupt read of the first device of the waiting list
+*					when there is room, a read which still does not fit puts its device
+*					back in the list. Called with interrupts disabled.
+*  Receives:		Nothing
+*  Returns:			TRUE when a read was queued.
 ***************************************************************************/
-BYTE ReadInterruptCaptureReg(MCP23017_Port port)
+static BOOL QueueWaitingRead(void)
 {
-	BYTE byteRead = 0;
+	struct MCP23017* device = waitingDevices;
 	
-	if(BankInUse == BANK0)
+	if(device == NULL || (BYTE)(eventReserved - eventTail) >= MCP23017_EVENT_LOG_SIZE)
 	{
-		if(port == MCP23017_PORTA)
-		{
-			byteRead = i2c_read1byte(address, MCP23017_INTCAPA);
-		}
-		else if(port == MCP23017_PORTB)
-		{
-			byteRead = i2c_read1byte(address, MCP23017_INTCAPB);
-		}
+		return FALSE;
+	}
+	
+	waitingDevices = device->nextWaiting;
+	device->interruptPending &= ~INTERRUPT_WAITING;
+	QueueInterruptRead(device);
+	
+	/* Back in the list when the TWI queue is full */
+	return !(device->interruptPending & INTERRUPT_WAITING);
+}
+
+/***************************************************************************
+*  Function:		FinishInterruptRead(struct MCP23017* device, BYTE status)
+*  Description:		Publishes the event slot of a finished interrupt read. In BANK0 the
+*					slot already holds the registers, in BANK1 the two bytes are placed
+*					at their port. An INT line which is still active (a change after
+*					the capture) gave no new edge, its read is queued right away.
+*					Called from the TWI interrupt.
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					BYTE status					:	The final status of the read.
+*  Returns:			Nothing
+***************************************************************************/
+static void FinishInterruptRead(struct MCP23017* device, BYTE status)
+{
+	struct MCP23017Event* event = &eventLog[device->interruptSlot & (MCP23017_EVENT_LOG_SIZE - 1)];
+	MCP23017_Port port;
+	
+	if(status != TWI_STATUS_DONE)
+	{
+		/* The slot is skipped by the main loop, IoExpanderCheckInterrupt() retries later */
+		event->device = NULL;
+		device->interruptPending &= ~INTERRUPT_PORTS;
 	}
-	else if(BankInUse == BANK1)
+	else
 	{
-		if(port == MCP23017_PORTA)
+		if(device->bank == BANK1)
 		{
-			byteRead = i2c_read1byte(address, MCP23017_INTCAPA_BANK1);
+			/* BANK1: INTF and INTCAP of the port which interrupted */
+			event->intf[device->interruptPort] = device->interruptData[0];
+			event->intcap[device->interruptPort] = (device->interruptData[0] != 0) ? device->interruptData[1] : 0;
 		}
-		else if(port == MCP23017_PORTB)
+		
+		for(port = MCP23017_PORTA; port <= MCP23017_PORTB; port++)
 		{
-			byteRead = i2c_read1byte(address, MCP23017_INTCAPB_BANK1);
+			if(IsInterruptActive(device, port))
+			{
+				SetInterruptPending(device, 1 << port, TimerGetTicks());
+			}
 		}
 	}
 	
-	return byteRead;
+	eventHead++;
+	
+	/* One waiting device per completion, the main loop queues the rest (IoExpanderServiceInterrupts) */
+	QueueWaitingRead();
+	
+	if((device->interruptPending & INTERRUPT_PORTS) && !(device->interruptPending & INTERRUPT_WAITING))
+	{
+		QueueInterruptRead(device);
+	}
 }
 
 /***************************************************************************
-*  Function:		SetPortReg(MCP23017_Port port, BYTE value)
-*  Description:		The GPIO register reflects the value on the port.
-*					Reading from this register reads the port. Writing to this
-*					register modifies the Output Latch (OLAT) register.
-*  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
-*					BYTE value				:	The value to set.
+*  Function:		InterruptFlagsDone(struct TwiRequest* request)
+*  Description:		Completion of the INTF read, the INTCAP read follows in the same
+*					transaction. It is trimmed to the ports whose flags are set, so
+*					an interrupt of the other port which arrives in between is not
+*					cleared and gets its own read. A failed read ends the chain.
+*					Called from the TWI interrupt, before the INTCAP read is on the bus.
+*  Receives:		struct TwiRequest* request	:	The first request of the interrupt chain.
 *  Returns:			Nothing
 ***************************************************************************/
-void SetPortReg(MCP23017_Port port, BYTE value)
+static void InterruptFlagsDone(struct TwiRequest* request)
 {
-	if(BankInUse == BANK0)
+	struct MCP23017* device = (struct MCP23017*)((BYTE*)request - offsetof(struct MCP23017, interruptRequest[0]));
+	struct MCP23017Event* event = &eventLog[device->interruptSlot & (MCP23017_EVENT_LOG_SIZE - 1)];
+	struct TwiRequest* capture = &device->interruptRequest[1];
+	
+	if(request->status != TWI_STATUS_DONE)
 	{
-		if(port == MCP23017_PORTA)
-		{
-			i2c_send(address, MCP23017_GPIOA, value);
-		}
-		else if(port == MCP23017_PORTB)
-		{
-			i2c_send(address, MCP23017_GPIOB, value);
-		}
+		FinishInterruptRead(device, request->status);
+		return;
 	}
-	else if(BankInUse == BANK1)
+	
+	if(device->bank == BANK1)
 	{
-		if(port == MCP23017_PORTA)
+		if(device->interruptData[0] == 0)
 		{
-			i2c_send(address, MCP23017_GPIOA_BANK1, value);
+			/* No flag: read INTF again instead, FinishInterruptRead() leaves the capture 0 */
+			capture->reg = request->reg;
 		}
-		else if(port == MCP23017_PORTB)
+		return;
+	}
+	
+	/* BANK0: only the capture of a flagged port is read, INTCAP of another port would clear */
+	/* its interrupt if it arrived after the flags were read */
+	if(event->intf[MCP23017_PORTA] == 0)
+	{
+		event->intcap[MCP23017_PORTA] = 0;
+		capture->reg = MCP23017_INTCAPB;
+		capture->buffer = &event->intcap[MCP23017_PORTB];
+		capture->length = 1;
+	}
+	
+	if(event->intf[MCP23017_PORTB] == 0)
+	{
+		event->intcap[MCP23017_PORTB] = 0;
+		capture->length = 1;
+		
+		if(event->intf[MCP23017_PORTA] == 0)
 		{
-			i2c_send(address, MCP23017_GPIOB_BANK1, value);
+			/* No flag at all: read INTFA again instead of a capture */
+			capture->reg = MCP23017_INTFA;
+			capture->buffer = &device->interruptData[1];
 		}
 	}
 }
+
+/***************************************************************************
+*  Function:		InterruptCaptureDone(struct TwiRequest* request)
+*  Description:		Completion of the INTCAP read, which clears the interrupt.
+*					Called from the TWI interrupt.
+*  Receives:		struct TwiRequest* request	:	The second request of the interrupt chain.
+*  Returns:			Nothing
+***************************************************************************/
+static void InterruptCaptureDone(struct TwiRequest* request)
+{
+	FinishInterruptRead((struct MCP23017*)((BYTE*)request - offsetof(struct MCP23017, interruptRequest[1])), request->status);
+}
+
+/***************************************************************************
+*  Function:		AttachInterruptPins(struct MCP23017* device, volatile BYTE* pins, BYTE maskA, BYTE maskB)
+*  Description:		Tells the driver where the INT lines are connected, after every
+*					interrupt read the lines are checked and a line which is still
+*					active is read again. A PCINT only fires on an edge, without the
+*					check a change during the read would leave the line active for good.
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					volatile BYTE* pins			:	The input register (for example &PINB).
+*					BYTE maskA					:	Pin of INTA, 0 when not connected.
+*					BYTE maskB					:	Pin of INTB, 0 when not connected.
+*  Returns:			Nothing
+***************************************************************************/
+void AttachInterruptPins(struct MCP23017* device, volatile BYTE* pins, BYTE maskA, BYTE maskB)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		device->interruptPins = pins;
+		device->interruptMask[MCP23017_PORTA] = maskA;
+		device->interruptMask[MCP23017_PORTB] = maskB;
+	}
+}
+
 /***************************************************************************
-*  Function:		BYTE ReadPortReg(MCP23017_Port port)
-*  Description:		The GPIO register reflects the value on the port.
-*					Reading from this register reads the port. Writing to this
-*					register modifies the Output Latch (OLAT) register.
-*  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
-*  Returns:			Byte that was read.
+*  Function:		IoExpanderInterrupt(struct MCP23017* device, MCP23017_Port port)
+*  Description:		To be called from the interrupt of the INT line (for example a pin
+*					change interrupt) as the first thing. Only takes the timestamp and
+*					marks the port, the read of INTF and INTCAP is queued by
+*					IoExpanderServiceInterrupts() in the main loop or when an interrupt
+*					read of another device finishes. The event is logged when the read
+*					is finished. In BANK0 both ports are read directly into the event
+*					log, in BANK1 only the given port. An interrupt which arrives while
+*					a read is pending is read as soon as it is finished, INTCAP does not
+*					change until it is read. Works in byte mode and in sequential mode.
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					MCP23017_Port port			:	The port whose INT line is active.
+*  Returns:			Nothing
 ***************************************************************************/
-BYTE ReadPortReg(MCP23017_Port port)
+void IoExpanderInterrupt(struct MCP23017* device, MCP23017_Port port)
 {
-	BYTE byteRead = 0;
+	uint32_t timestamp = TimerGetTicks();
 	
-	if(BankInUse == BANK0)
+	if(!device->isInitialized)
 	{
-		if(port == MCP23017_PORTA)
-		{
-			byteRead = i2c_read1byte(address, MCP23017_GPIOA);
-		}
-		else if(port == MCP23017_PORTB)
-		{
-			byteRead = i2c_read1byte(address, MCP23017_GPIOB);
-		}
+		return;
 	}
-	else if(BankInUse == BANK1)
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 	{
-		if(port == MCP23017_PORTA)
-		{
-			byteRead = i2c_read1byte(address, MCP23017_GPIOA_BANK1);
-		}
-		else if(port == MCP23017_PORTB)
+		SetInterruptPending(device, 1 << port, timestamp);
+		
+		/* A pending read picks the port up when it is finished */
+		if(device->interruptRequest[1].status != TWI_STATUS_PENDING)
 		{
-			byteRead = i2c_read1byte(address, MCP23017_GPIOB_BANK1);
+			AddWaitingDevice(device);
 		}
 	}
-	
-	return byteRead;
 }
 
 /***************************************************************************
-*  Function:		SetOutputLatchReg(MCP23017_Port port, BYTE value)
-*  Description:		The OLAT register provides access to the output
-*					latches. A read from this register results in a read of the
-*					OLAT and not the port itself. A write to this register
-*					modifies the output latches that modifies the pins
-*					configured as outputs.
-*  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
-*					BYTE value				:	The value to set.
+*  Function:		IoExpanderServiceInterrupts()
+*  Description:		Queues the interrupt reads of the waiting devices, to be called
+*					from the main loop. Interrupts are disabled for one device at a
+*					time, not for the whole list.
+*  Receives:		Nothing
 *  Returns:			Nothing
 ***************************************************************************/
-void SetOutputLatchReg(MCP23017_Port port, BYTE value)
+void IoExpanderServiceInterrupts(void)
 {
-	if(BankInUse == BANK0)
+	BOOL queued = TRUE;
+	
+	while(queued)
 	{
-		if(port == MCP23017_PORTA)
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
 		{
-			i2c_send(address, MCP23017_OLATA, value);
-		}
-		else if(port == MCP23017_PORTB)
-		{
-			i2c_send(address, MCP23017_OLATB, value);
+#ifdef TWI_INSTRUMENTATION
+			uint16_t start = (uint16_t)TimerGetTicks();
+#endif
+			queued = QueueWaitingRead();
+#ifdef TWI_INSTRUMENTATION
+			TwiRecordBlocking(start);
+#endif
 		}
 	}
-	else if(BankInUse == BANK1)
+}
+
+/***************************************************************************
+*  Function:		BOOL HasInterruptWork()
+*  Description:		Checks if there are logged events or interrupt reads to queue, the
+*					main loop must not sleep then. Cheap enough to be called with
+*					interrupts disabled right before sleeping.
+*  Receives:		Nothing
+*  Returns:			TRUE when the main loop has to run again.
+***************************************************************************/
+BOOL HasInterruptWork(void)
+{
+	return (eventTail != eventHead || waitingDevices != NULL);
+}
+
+/***************************************************************************
+*  Function:		IoExpanderCheckInterrupt(struct MCP23017* device)
+*  Description:		Queues the interrupt read when an attached INT line is active, for
+*					example after a failed read or after the device came back online.
+*					Called from the main loop.
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*  Returns:			Nothing
+***************************************************************************/
+void IoExpanderCheckInterrupt(struct MCP23017* device)
+{
+	MCP23017_Port port;
+	
+	for(port = MCP23017_PORTA; port <= MCP23017_PORTB; port++)
 	{
-		if(port == MCP23017_PORTA)
-		{
-			i2c_send(address, MCP23017_OLATA_BANK1, value);
-		}
-		else if(port == MCP23017_PORTB)
+		if(IsInterruptActive(device, port))
 		{
-			i2c_send(address, MCP23017_OLATB_BANK1, value);
+			IoExpanderInterrupt(device, port);
 		}
 	}
+	
+	IoExpanderServiceInterrupts();
 }
+
 /***************************************************************************
-*  Function:		BYTE ReadOutputLatchReg(MCP23017_Port port)
-*  Description:		The OLAT register provides access to the output
-*					latches. A read from this register results in a read of the
-*					OLAT and not the port itself. A write to this register
-*					modifies the output latches that modifies the pins
-*					configured as outputs.
-*  Receives:		MCP23017_Port port		:	The port on the MCP23017 (MCP23017_PORTA or MCP23017_PORTB).
-*  Returns:			Byte that was read.
+*  Function:		BYTE DrainEvents(struct MCP23017Event* events, BYTE maxEvents)
+*  Description:		Moves the logged interrupt events, oldest first, to the caller.
+*  Receives:		struct MCP23017Event* events	:	Receives the events.
+*					BYTE maxEvents					:	Room in events.
+*  Returns:			The number of events.
 ***************************************************************************/
-BYTE ReadOutputLatchReg(MCP23017_Port port)
+BYTE DrainEvents(struct MCP23017Event* events, BYTE maxEvents)
 {
-	BYTE byteRead = 0;
+	const struct MCP23017Event* event;
+	BYTE count = 0;
 	
-	if(BankInUse == BANK0)
+	while(count < maxEvents && (event = PeekEvent()) != NULL)
 	{
-		if(port == MCP23017_PORTA)
-		{
-			byteRead = i2c_read1byte(address, MCP23017_OLATA);
-		}
-		else if(port == MCP23017_PORTB)
-		{
-			byteRead = i2c_read1byte(address, MCP23017_OLATB);
-		}
+		events[count++] = *event;
+		ReleaseEvent();
 	}
-	else if(BankInUse == BANK1)
+	
+	return count;
+}
+
+/***************************************************************************
+*  Function:		const struct MCP23017Event* PeekEvent()
+*  Description:		Returns the oldest logged interrupt event without copying it, the
+*					slot stays valid until ReleaseEvent() is called.
+*  Receives:		Nothing
+*  Returns:			The event, NULL when the log is empty.
+***************************************************************************/
+const struct MCP23017Event* PeekEvent(void)
+{
+	struct MCP23017Event* event;
+	
+	/* Single producer (TWI interrupt) and single consumer, only the consumer moves the tail */
+	while(eventTail != eventHead)
 	{
-		if(port == MCP23017_PORTA)
-		{
-			byteRead = i2c_read1byte(address, MCP23017_OLATA_BANK1);
-		}
-		else if(port == MCP23017_PORTB)
+		event = &eventLog[eventTail & (MCP23017_EVENT_LOG_SIZE - 1)];
+		
+		if(event->device != NULL)
 		{
-			byteRead = i2c_read1byte(address, MCP23017_OLATB_BANK1);
+			return event;
 		}
+		
+		/* Failed read */
+		ReleaseEvent();
 	}
 	
-	return byteRead;
-}
\ No newline at end of file
+	return NULL;
+}
+
+/***************************************************************************
+*  Function:		ReleaseEvent()
+*  Description:		Gives the slot returned by PeekEvent() back to the log.
+*  Receives:		Nothing
+*  Returns:			Nothing
+***************************************************************************/
+void ReleaseEvent(void)
+{
+	/* Only the main loop moves the tail, the freed slot goes to a waiting interrupt read */
+	/* with the next IoExpanderServiceInterrupts() */
+	eventTail++;
+}
+
+/***************************************************************************
+*  Function:		uint16_t GetEventOverflows()
+*  Description:		Returns the number of interrupt reads which had to wait because the
+*					log or the TWI queue was full, their events were logged later.
+*  Receives:		Nothing
+*  Returns:			The number of deferred reads.
+***************************************************************************/
+uint16_t GetEventOverflows(void)
+{
+	uint16_t overflows;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		overflows = eventOverflows;
+	}
+	
+	return overflows;
+}
@@ -15,26 +15,25 @@
  *--------------------------------------------------------------------------------------------------------------------------------------------------------*/
 
 
-#ifndef _H_
-#define _H_
+#ifndef MCP23017_H_
+#define MCP23017_H_
 
 
 #include "common.h"
+#include "twi.h"
+#include "async.h"
 /************************************************************************/
 /* Enumerations												   */
 /************************************************************************/
 
-enum{BANK0, BANK1} BankInUse;
-enum{MCP23017_PORTA, MCP23017_PORTB} MCP23017_Port;
+typedef enum {BANK0, BANK1} BankInUse;
+typedef enum {MCP23017_PORTA, MCP23017_PORTB} MCP23017_Port;
 	
 	
 /************************************************************************/
 /* Defines													   */
 /************************************************************************/
 
-enum{BANK0, BANK1} BankInUse;
-enum{MCP23017_PORTA, MCP23017_PORTB} MCP23017_Port;
-
 /* Address pins */
 #define MCP23017_ADDR_PIN0          0x01     /*A0*/
 #define MCP23017_ADDR_PIN1          0x02     /*A1*/
@@ -112,12 +111,12 @@ enum{MCP23017_PORTA, MCP23017_PORTB} MCP23017_Port;
 #define MCP23017_OLATA_BANK1        0x0A    /*OUTPUT LATCH REGISTER A*/
 #define MCP23017_OLATB_BANK1        0x1A    /*OUTPUT LATCH REGISTER B*/
 
-#define MCP23017_IOCON_BANK1        MCP23017_IOCONA_BANK
+#define MCP23017_IOCON_BANK1        MCP23017_IOCONA_BANK1
 
 /* IOCON bits */
-#define MCP23017_INTPOL             0x20    /* This bit sets the polarity of the INT output pin.*/
-#define MCP23017_ODR                0x40    /* This bit configures the INT pin as an open-drain output.*/
-#define MCP23017_HAEN               0x80    /* Hardware Address Enable bit (MCP23S17 only). Address pins are always enabled on MCP23017.*/
+#define MCP23017_INTPOL             0x02    /* This bit sets the polarity of the INT output pin.*/
+#define MCP23017_ODR                0x04    /* This bit configures the INT pin as an open-drain output.*/
+#define MCP23017_HAEN               0x08    /* Hardware Address Enable bit (MCP23S17 only). Address pins are always enabled on MCP23017.*/
 #define MCP23017_DISSLW             0x10    /* Slew Rate control bit for SDA output.*/
 #define MCP23017_SEQOP              0x20    /* Sequential Operation mode bit.*/
 #define MCP23017_MIRROR             0x40    /* INT Pins Mirror bit.*/
@@ -133,17 +132,213 @@ enum{MCP23017_PORTA, MCP23017_PORTB} MCP23017_Port;
 #define MCP23017_PIN6               0x40
 #define MCP23017_PIN7               0x80
 
+/* Number of registers, in BANK0 the registers are at address 0x00 up to and including 0x15 */
+#define MCP23017_REGISTER_COUNT     22
+
+/* Number of requests of DumpRegistersAsync(), the dump is finished with the last one */
+#define MCP23017_DUMP_REQUESTS      4
+
+/* Register pairs, the position of a pair in the register map of either bank */
+#define MCP23017_INDEX_IODIR        0
+#define MCP23017_INDEX_IPOL         1
+#define MCP23017_INDEX_GPINTEN      2
+#define MCP23017_INDEX_DEFVAL       3
+#define MCP23017_INDEX_INTCON       4
+#define MCP23017_INDEX_IOCON        5
+#define MCP23017_INDEX_GPPU         6
+#define MCP23017_INDEX_INTF         7
+#define MCP23017_INDEX_INTCAP       8
+#define MCP23017_INDEX_GPIO         9
+#define MCP23017_INDEX_OLAT         10
+
+/* Register address of a pair and port (MCP23017_PORTA or MCP23017_PORTB). BANK0 interleaves the */
+/* ports (A at the even, B at the odd address), BANK1 keeps them apart (B at 0x10 and up). */
+/* With a variable bank this is a compare and a shift or swap, no table or switch. */
+#define MCP23017_REGISTER_BANK0(index, port)		((BYTE)(((index) << 1) | (port)))
+#define MCP23017_REGISTER_BANK1(index, port)		((BYTE)(((port) << 4) | (index)))
+#define MCP23017_REGISTER(bank, index, port)		(((bank) == BANK0) ? MCP23017_REGISTER_BANK0(index, port) : MCP23017_REGISTER_BANK1(index, port))
+
+/* Statistics classes of the bus transactions (TWI_INSTRUMENTATION), one per register pair */
+#define MCP23017_CLASS_IODIR        MCP23017_INDEX_IODIR
+#define MCP23017_CLASS_IPOL         MCP23017_INDEX_IPOL
+#define MCP23017_CLASS_GPINTEN      MCP23017_INDEX_GPINTEN
+#define MCP23017_CLASS_DEFVAL       MCP23017_INDEX_DEFVAL
+#define MCP23017_CLASS_INTCON       MCP23017_INDEX_INTCON
+#define MCP23017_CLASS_IOCON        MCP23017_INDEX_IOCON
+#define MCP23017_CLASS_GPPU         MCP23017_INDEX_GPPU
+#define MCP23017_CLASS_INTF         MCP23017_INDEX_INTF
+#define MCP23017_CLASS_INTCAP       MCP23017_INDEX_INTCAP
+#define MCP23017_CLASS_GPIO         MCP23017_INDEX_GPIO
+#define MCP23017_CLASS_OLAT         MCP23017_INDEX_OLAT
+#define MCP23017_CLASS_BURST        11      /* Register map bursts (restore, dump) and chains */
+
+/* Number of entries in the interrupt event log, must be a power of 2 */
+#define MCP23017_EVENT_LOG_SIZE     16
+
+/* Address range of the MCP23017, set by the A2..A0 pins */
+#define MCP23017_ADDRESS_FIRST      0x20
+#define MCP23017_ADDRESS_LAST       0x27
+
+/* Register values after a power-on reset, all pins are inputs and all other registers are cleared */
+#define MCP23017_IODIR_DEFAULT      0xFF
+
+/* Input profiles: the register bits of one pin, combined at compile time by MCP23017_INPUT_PROFILE */
+#define MCP23017_PIN_INPUT          0x01    /* IODIR */
+#define MCP23017_PIN_INVERT         0x02    /* IPOL */
+#define MCP23017_PIN_INTERRUPT      0x04    /* GPINTEN */
+#define MCP23017_PIN_DEFVAL         0x08    /* DEFVAL */
+#define MCP23017_PIN_COMPARE        0x10    /* INTCON */
+#define MCP23017_PIN_PULLUP         0x20    /* GPPU */
+
+#define MCP23017_PROFILE_OUTPUT     0
+#define MCP23017_PROFILE_INPUT      (MCP23017_PIN_INPUT)
+/* Button to ground, reads 1 when pressed, interrupt on press and release */
+#define MCP23017_PROFILE_BUTTON     (MCP23017_PIN_INPUT | MCP23017_PIN_PULLUP | MCP23017_PIN_INVERT | MCP23017_PIN_INTERRUPT)
+/* Button to ground, interrupt while pressed (pin differs from DEFVAL = 1) */
+#define MCP23017_PROFILE_BUTTON_PRESS (MCP23017_PIN_INPUT | MCP23017_PIN_PULLUP | MCP23017_PIN_INTERRUPT | \
+                                     MCP23017_PIN_DEFVAL | MCP23017_PIN_COMPARE)
+/* Active-high sensor output, interrupt on every change */
+#define MCP23017_PROFILE_SENSOR     (MCP23017_PIN_INPUT | MCP23017_PIN_INTERRUPT)
+/* Shared open-drain line with an external pull-up (for example an alarm), no internal pull-up so the */
+/* line is not loaded by every device, interrupt while a device pulls it low (pin differs from DEFVAL = 1) */
+#define MCP23017_PROFILE_OPEN_DRAIN (MCP23017_PIN_INPUT | MCP23017_PIN_INTERRUPT | MCP23017_PIN_DEFVAL | MCP23017_PIN_COMPARE)
+
+/* Number of bytes of a profile: IODIRA up to and including GPPUB in BANK0 order */
+#define MCP23017_PROFILE_LENGTH     (MCP23017_GPPUB - MCP23017_IODIRA + 1)
+
+/* Register value of one bit of a profile for the pins 0-7 of a port */
+#define MCP23017_PIN_BITS(bit, p0, p1, p2, p3, p4, p5, p6, p7) \
+    ((((p0) & (bit)) ? 0x01 : 0) | (((p1) & (bit)) ? 0x02 : 0) | (((p2) & (bit)) ? 0x04 : 0) | (((p3) & (bit)) ? 0x08 : 0) | \
+     (((p4) & (bit)) ? 0x10 : 0) | (((p5) & (bit)) ? 0x20 : 0) | (((p6) & (bit)) ? 0x40 : 0) | (((p7) & (bit)) ? 0x80 : 0))
+#define MCP23017_APPLY(macro, ...)  macro(__VA_ARGS__)
+#define MCP23017_UNPACK(...)        __VA_ARGS__
+#define MCP23017_PORT_BITS(bit, pins) MCP23017_APPLY(MCP23017_PIN_BITS, bit, MCP23017_UNPACK pins)
+
+/* Initializer of a BYTE[MCP23017_PROFILE_LENGTH] from the IOCON value and the profiles of the */
+/* pins 0-7 of PORTA and PORTB, each given as a list in parentheses. Evaluated by the compiler. */
+#define MCP23017_INPUT_PROFILE(iocon, portA, portB) \
+    { MCP23017_PORT_BITS(MCP23017_PIN_INPUT, portA), MCP23017_PORT_BITS(MCP23017_PIN_INPUT, portB), \
+      MCP23017_PORT_BITS(MCP23017_PIN_INVERT, portA), MCP23017_PORT_BITS(MCP23017_PIN_INVERT, portB), \
+      MCP23017_PORT_BITS(MCP23017_PIN_INTERRUPT, portA), MCP23017_PORT_BITS(MCP23017_PIN_INTERRUPT, portB), \
+      MCP23017_PORT_BITS(MCP23017_PIN_DEFVAL, portA), MCP23017_PORT_BITS(MCP23017_PIN_DEFVAL, portB), \
+      MCP23017_PORT_BITS(MCP23017_PIN_COMPARE, portA), MCP23017_PORT_BITS(MCP23017_PIN_COMPARE, portB), \
+      (iocon), (iocon), \
+      MCP23017_PORT_BITS(MCP23017_PIN_PULLUP, portA), MCP23017_PORT_BITS(MCP23017_PIN_PULLUP, portB) }
+
 
 
 /************************************************************************/
 /* Type Definitions			                                            */
 /************************************************************************/
 
+/* Complete register map in BANK0 order, every register is an A/B pair indexed by MCP23017_Port. */
+/* Used for the configuration blob (can be stored in EEPROM as is) and for the register shadow. */
+union MCP23017Registers
+{
+	BYTE raw[MCP23017_REGISTER_COUNT];		/* Indexed by the BANK0 register address */
+	struct
+	{
+		BYTE iodir[2];
+		BYTE ipol[2];
+		BYTE gpinten[2];
+		BYTE defval[2];
+		BYTE intcon[2];
+		BYTE iocon[2];
+		BYTE gppu[2];
+		BYTE intf[2];
+		BYTE intcap[2];
+		BYTE gpio[2];
+		BYTE olat[2];
+	};
+};
+
+/* Shared between the main loop and interrupts, fields are only changed inside an atomic block */
+struct MCP23017
+{
+	BYTE address;
+	BankInUse bank;
+	
+	/* Multiplexer in front of the IO Expander (NULL when directly connected) and its channel */
+	struct TwiMux* mux;
+	BYTE channel;
+	
+	/* Last values read from GPIOA and GPIOB by the scanner */
+	BYTE inputs[2];
+	
+	/* Specifies if the IO Expander is initialized */
+	BOOL isInitialized;
+	
+	/* Cleared when the IO Expander stops responding, set again by the health check */
+	BOOL isOnline;
+	
+	/* Last values written to the registers, the read-only registers are not used */
+	union MCP23017Registers shadow;
+	
+	/* Value of the queued IOCON write, owned by the TWI driver while the write is pending */
+	BYTE ioconWrite;
+	
+	/* Interrupt servicing: INTF and INTCAP are read by a chain of two requests, owned by the TWI */
+	/* driver while pending. In BANK0 the pairs are read directly into the event log, BANK1 uses interruptData */
+	struct TwiRequest interruptRequest[2];
+	BYTE interruptData[2];
+	MCP23017_Port interruptPort;
+	BYTE interruptSlot;
+	
+	/* Interrupts which are not read yet (bit per port), the time of the first one and the next */
+	/* device whose interrupt read still has to be queued */
+	volatile BYTE interruptPending;
+	uint32_t interruptTicks;
+	struct MCP23017* nextWaiting;
+	
+	/* Input register and pins of the INT lines (AttachInterruptPins), NULL when not attached */
+	volatile BYTE* interruptPins;
+	BYTE interruptMask[2];
+};
+
+/* An interrupt of the IO Expander, the registers are in BANK0 order (INTFA, INTFB, INTCAPA, INTCAPB) */
+struct MCP23017Event
+{
+	uint32_t timestamp;						/* Timer ticks at interrupt entry (TIMER_TICKS_PER_US) */
+	struct MCP23017* device;				/* The IO Expander which generated the interrupt, NULL when the read failed */
+	BYTE address;							/* Its address, not unique behind a multiplexer */
+	BYTE intf[2];							/* Pins which caused the interrupt */
+	BYTE intcap[2];							/* Port values at the time of the interrupt, must follow intf */
+};
+
+/* State of RestoreIoExpanderTask(), owned by the caller and untouched while the task runs */
+struct MCP23017RestoreTask
+{
+	AsyncContext context;
+	struct MCP23017* device;
+	const union MCP23017Registers* config;
+	union MCP23017Registers burst;			/* The configuration as written, IOCON in BANK0 with sequential operation */
+	union MCP23017Registers readBack;
+	struct TwiRequest request;
+	BOOL restored;							/* The result, valid when the task returned ASYNC_DONE */
+};
+
+extern struct MCP23017 mcp23017;
+
 	
 /************************************************************************/
 /* API					                                                */
 /************************************************************************/
 void InitializeIoExpander(BYTE address, BankInUse bank);
+void InitializeIoExpanderDevice(struct MCP23017* device, BYTE address, struct TwiMux* mux, BYTE channel, BankInUse bank);
+void SwitchBank(struct MCP23017* device, BankInUse bank);
+void SetSequentialOperation(struct MCP23017* device, BOOL enabled);
+BOOL SwitchBankAsync(struct MCP23017* device, struct TwiRequest* request, BankInUse bank);
+BOOL SetSequentialOperationAsync(struct MCP23017* device, struct TwiRequest* request, BOOL enabled);
+void WriteIoExpanderRegister(struct MCP23017* device, BYTE reg, BYTE value);
+BYTE ReadIoExpanderRegister(struct MCP23017* device, BYTE reg);
+BOOL WriteIoExpanderRegisterAsync(struct MCP23017* device, struct TwiRequest* request, BYTE reg, const BYTE* value);
+BOOL ReadIoExpanderRegisterAsync(struct MCP23017* device, struct TwiRequest* request, BYTE reg, BYTE* value);
+
+/* Register blocks, the TWI interrupt uses the caller's buffer directly */
+BYTE WriteIoExpanderBurst(struct MCP23017* device, BYTE reg, const BYTE* data, BYTE length);
+BYTE ReadIoExpanderBurst(struct MCP23017* device, BYTE reg, BYTE* data, BYTE length);
+BOOL WriteIoExpanderBurstAsync(struct MCP23017* device, struct TwiRequest* request, BYTE reg, const BYTE* data, BYTE length);
+BOOL ReadIoExpanderBurstAsync(struct MCP23017* device, struct TwiRequest* request, BYTE reg, BYTE* data, BYTE length);
 
 void SetPortDirectionReg(MCP23017_Port port, BYTE value);
 BYTE ReadPortDirectionReg(MCP23017_Port port);
@@ -169,5 +364,39 @@ BYTE ReadOutputLatchReg(MCP23017_Port port);
 BYTE ReadInterruptFlagReg(MCP23017_Port port);
 BYTE ReadInterruptCaptureReg(MCP23017_Port port);
 
+/* Input profiles */
+BYTE ApplyInputProfile(struct MCP23017* device, const BYTE* profile);
+
+/* Configuration snapshot and restore */
+void SnapshotIoExpander(struct MCP23017* device, union MCP23017Registers* config);
+BOOL RestoreIoExpander(struct MCP23017* device, const union MCP23017Registers* config);
+void StartRestoreIoExpander(struct MCP23017RestoreTask* task, struct MCP23017* device, const union MCP23017Registers* config);
+BYTE RestoreIoExpanderTask(struct MCP23017RestoreTask* task);
+BOOL IsIoExpanderConfigured(struct MCP23017* device);
+BOOL ProbeIoExpander(struct MCP23017* device);
+BOOL ProbeIoExpanderAsync(struct MCP23017* device, struct TwiRequest* request);
+
+/* Diagnostics */
+BOOL DumpRegisters(struct MCP23017* device, union MCP23017Registers* registers);
+BOOL DumpRegistersAsync(struct MCP23017* device, struct TwiRequest* requests, union MCP23017Registers* registers);
+BYTE DiffRegisters(struct MCP23017* device, const union MCP23017Registers* registers, union MCP23017Registers* drift);
+
+/* Interrupt servicing and event log */
+void AttachInterruptPins(struct MCP23017* device, volatile BYTE* pins, BYTE maskA, BYTE maskB);
+void IoExpanderInterrupt(struct MCP23017* device, MCP23017_Port port);
+void IoExpanderCheckInterrupt(struct MCP23017* device);
+void IoExpanderServiceInterrupts(void);
+BOOL HasInterruptWork(void);
+BYTE DrainEvents(struct MCP23017Event* events, BYTE maxEvents);
+const struct MCP23017Event* PeekEvent(void);
+void ReleaseEvent(void);
+uint16_t GetEventOverflows(void);
+
+/* Streaming with sequential operation disabled */
+BYTE StreamReadPort(struct MCP23017* device, MCP23017_Port port, BYTE* samples, BYTE count);
+BYTE StreamWritePort(struct MCP23017* device, MCP23017_Port port, const BYTE* patterns, BYTE count);
+BOOL StreamReadPortAsync(struct MCP23017* device, struct TwiRequest* request, MCP23017_Port port, BYTE* samples, BYTE count);
+BOOL StreamWritePortAsync(struct MCP23017* device, struct TwiRequest* request, MCP23017_Port port, const BYTE* patterns, BYTE count);
+
 
-#endif /* _H_ */
\ No newline at end of file
+#endif /* MCP23017_H_ */
\ No newline at end of file
@@ -0,0 +1,77 @@
+/*--------------------------------------------------------------------------------------------------------------------------------------------------------
+ * Project:			MCP23017 TWI Library
+ * Hardware:		Arduino UNO
+ * Micro:			ATMEGA328P
+ * IDE:				Atmel Studio 6.2
+ *
+ * Name:    		power.c
+ * Purpose: 		Sleep until the IO Expander (or the TWI) needs the CPU
+ * Date:			19-10-2026
+ * Version:			1.0
+ * Author:			Marcel van der Ven
+ *
+ *
+ * Note(s):			See power.h
+ *--------------------------------------------------------------------------------------------------------------------------------------------------------*/
+
+/************************************************************************/
+/* Includes
+/************************************************************************/
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "power.h"
+#include "twi.h"
+
+
+/************************************************************************/
+/* Functions
+/************************************************************************/
+
+/***************************************************************************
+*  Function:		PowerInitialize()
+*  Description:		Switches off the peripherals the library does not use: ADC,
+*					analog comparator, SPI, USART, Timer0 and Timer2. TWI and
+*					Timer1 stay powered.
+*  Receives:		Nothing
+*  Returns:			Nothing
+***************************************************************************/
+void PowerInitialize(void)
+{
+	ADCSRA = 0;
+	ACSR = (1 << ACD);
+	PRR = (1 << PRADC) | (1 << PRSPI) | (1 << PRUSART0) | (1 << PRTIM0) | (1 << PRTIM2);
+}
+
+/***************************************************************************
+*  Function:		PowerSleep()
+*  Description:		Puts the CPU to sleep until an interrupt occurs. Must be called
+*					with interrupts disabled after the main loop checked that there
+*					is no work (for example no logged events); interrupts are enabled
+*					by the instruction before SLEEP, so an interrupt after the check
+*					can not be missed (it wakes the CPU right away).
+*					Idle while the TWI is busy or Timer1 compare A is used,
+*					POWER_SLEEP_MODE otherwise.
+*  Receives:		Nothing
+*  Returns:			Nothing, interrupts are enabled.
+***************************************************************************/
+void PowerSleep(void)
+{
+	/* A STOP condition which is still being generated also needs the clock */
+	if(!TwiIsIdle() || (TWCR & (1 << TWSTO)) || (TIMSK1 & (1 << OCIE1A)))
+	{
+		set_sleep_mode(SLEEP_MODE_IDLE);
+		sleep_enable();
+	}
+	else
+	{
+		set_sleep_mode(POWER_SLEEP_MODE);
+		sleep_enable();
+#if POWER_SLEEP_MODE != SLEEP_MODE_IDLE
+		sleep_bod_disable();
+#endif
+	}
+
+	sei();
+	sleep_cpu();
+	sleep_disable();
+}
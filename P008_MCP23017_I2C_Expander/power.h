@@ -0,0 +1,52 @@
+/*--------------------------------------------------------------------------------------------------------------------------------------------------------
+ * Project: 		MCP23017 TWI Library
+ * Hardware:		Arduino UNO
+ * Micro:			ATMEGA328P
+ * IDE:				Atmel Studio 6.2
+ *
+ * Name:    		power.h
+ * Purpose: 		Sleep until the IO Expander (or the TWI) needs the CPU
+ * Date:			19-10-2026
+ * Author:			Marcel van der Ven
+ *
+ * Hardware setup:	INT lines of the IO Expander on pin change interrupt pins (see main.c).
+ *
+ * Note(s):			While a transaction is on the bus the CPU only idles (the TWI needs the clock),
+ *					otherwise it goes to POWER_SLEEP_MODE. The default is idle: Timer1 keeps running,
+ *					so the event timestamps, the TWI deadlines and the slew timing stay correct, and
+ *					the Timer1 overflow wakes the CPU every 32.8 ms. Power-down and standby stop
+ *					Timer1 and are only meant for builds which use none of these; only a pin change
+ *					(the INT line) wakes the CPU then. While the BCM engine runs (compare A interrupt
+ *					enabled) the CPU only idles as well.
+ *
+ *					Wake-to-event latency, calculated for 16 MHz and 400 kHz: idle wakes up within a
+ *					few clocks, power-down needs the crystal start-up of 16K clocks (1 ms), standby
+ *					6 clocks. The INTF/INTCAP read takes 0.23 ms, so an event is available about
+ *					0.24 ms (idle, standby) or 1.2 ms (power-down) after the INT line changes.
+ *--------------------------------------------------------------------------------------------------------------------------------------------------------*/
+
+
+#ifndef POWER_H_
+#define POWER_H_
+
+
+#include <avr/sleep.h>
+#include "common.h"
+
+/************************************************************************/
+/* Defines													   */
+/************************************************************************/
+
+/* Sleep mode without bus activity: SLEEP_MODE_IDLE (Timer1 keeps running), or only when timestamps, */
+/* deadlines and slew timing are not used SLEEP_MODE_PWR_DOWN (lowest current) or SLEEP_MODE_STANDBY */
+#define POWER_SLEEP_MODE			SLEEP_MODE_IDLE
+
+
+/************************************************************************/
+/* API					                                                */
+/************************************************************************/
+void PowerInitialize(void);
+void PowerSleep(void);
+
+
+#endif /* POWER_H_ */
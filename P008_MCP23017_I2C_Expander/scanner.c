@@ -0,0 +1,231 @@
+/*--------------------------------------------------------------------------------------------------------------------------------------------------------
+ * Project:			MCP23017 TWI Library
+ * Hardware:		Arduino UNO
+ * Micro:			ATMEGA328P
+ * IDE:				Atmel Studio 6.2
+ *
+ * Name:    		scanner.c
+ * Purpose: 		Reads the inputs of many IO Expanders, also behind I2C multiplexers
+ * Date:			19-10-2026
+ * Version:			1.0
+ * Author:			Marcel van der Ven
+ *
+ *
+ * Note(s):			See scanner.h
+ *--------------------------------------------------------------------------------------------------------------------------------------------------------*/
+
+/************************************************************************/
+/* Includes
+/************************************************************************/
+#include "scanner.h"
+#include "twi.h"
+
+
+/************************************************************************/
+/* Functions
+/************************************************************************/
+
+/***************************************************************************
+*  Function:		BOOL IsRoutedBefore(struct MCP23017* first, struct MCP23017* second)
+*  Description:		Compares the route (multiplexer and channel) of two devices.
+*  Receives:		struct MCP23017* first		:	The first device.
+*					struct MCP23017* second		:	The second device.
+*  Returns:			TRUE when the first device has to be scanned before the second.
+***************************************************************************/
+static BOOL IsRoutedBefore(struct MCP23017* first, struct MCP23017* second)
+{
+	if(first->mux != second->mux)
+	{
+		return ((uintptr_t)first->mux < (uintptr_t)second->mux);
+	}
+
+	return (first->channel < second->channel);
+}
+
+/***************************************************************************
+*  Function:		ScannerInitialize(struct Scanner* scanner, struct MCP23017** devices, BYTE count)
+*  Description:		Sorts the devices by multiplexer and channel (insertion sort, the
+*					list is short and sorted once). The devices must be initialized.
+*  Receives:		struct Scanner* scanner			:	The scanner.
+*					struct MCP23017** devices		:	The IO Expanders, the array is reordered.
+*					BYTE count						:	Number of devices.
+*  Returns:			Nothing
+***************************************************************************/
+void ScannerInitialize(struct Scanner* scanner, struct MCP23017** devices, BYTE count)
+{
+	struct MCP23017* device;
+	BYTE i;
+	BYTE j;
+
+	for(i = 1; i < count; i++)
+	{
+		device = devices[i];
+
+		for(j = i; j > 0 && IsRoutedBefore(device, devices[j - 1]); j--)
+		{
+			devices[j] = devices[j - 1];
+		}
+
+		devices[j] = device;
+	}
+
+	scanner->devices = devices;
+	scanner->count = count;
+	scanner->healthIndex = 0;
+}
+
+/***************************************************************************
+*  Function:		CheckHealth(struct MCP23017* device)
+*  Description:		Probes a device and updates its online state. A device which
+*					returns, or which answers but lost its configuration, gets the
+*					configuration of the register shadow back. An active INT line of
+*					a responding device is read again.
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*  Returns:			Nothing
+***************************************************************************/
+static void CheckHealth(struct MCP23017* device)
+{
+	union MCP23017Registers config;
+	
+	if(!ProbeIoExpander(device))
+	{
+		device->isOnline = FALSE;
+		return;
+	}
+	
+	if(!device->isOnline || !IsIoExpanderConfigured(device))
+	{
+		SnapshotIoExpander(device, &config);
+		device->isOnline = RestoreIoExpander(device, &config);
+	}
+	
+	/* An INT line left active by a failed interrupt read gives no new edge */
+	if(device->isOnline)
+	{
+		IoExpanderCheckInterrupt(device);
+	}
+}
+
+/***************************************************************************
+*  Function:		BYTE ScannerRun(struct Scanner* scanner)
+*  Description:		Reads GPIOA and GPIOB of all devices into their inputs. In BANK0
+*					both ports are one 2-byte read (the pointer moves to GPIOB with and
+*					without sequential operation), in BANK1 two 1-byte reads are chained.
+*					Devices which do not respond keep their previous inputs and are
+*					marked offline, offline devices are skipped. Afterwards the health
+*					of one device is checked.
+*  Receives:		struct Scanner* scanner		:	The scanner.
+*  Returns:			The number of devices which were read.
+***************************************************************************/
+BYTE ScannerRun(struct Scanner* scanner)
+{
+	struct TwiRequest requests[2 * SCANNER_BATCH];
+	struct MCP23017* batch[SCANNER_BATCH];
+	struct TwiRequest* request;
+	struct MCP23017* device;
+	BYTE read = 0;
+	BYTE next = 0;
+	BYTE count;
+	BYTE status;
+	BYTE i;
+
+	while(next < scanner->count)
+	{
+		/* Collect the next online devices */
+		for(count = 0; count < SCANNER_BATCH && next < scanner->count; next++)
+		{
+			if(scanner->devices[next]->isOnline)
+			{
+				batch[count++] = scanner->devices[next];
+			}
+		}
+
+		for(i = 0; i < count; i++)
+		{
+			device = batch[i];
+			request = &requests[i << 1];
+
+			*request = (struct TwiRequest){ .address = device->address, .mux = device->mux, .channel = device->channel,
+											.reg = MCP23017_GPIOA, .flags = TWI_READ, .length = 2, .buffer = device->inputs,
+											.statisticsClass = MCP23017_CLASS_GPIO, .priority = TWI_PRIORITY_SCAN };
+
+			if(device->bank == BANK1)
+			{
+				request->reg = MCP23017_GPIOA_BANK1;
+				request->length = 1;
+				request->next = request + 1;
+				request[1] = *request;
+				request[1].reg = MCP23017_GPIOB_BANK1;
+				request[1].buffer = &device->inputs[MCP23017_PORTB];
+				request[1].next = NULL;
+			}
+
+			while(!TwiSubmit(request))
+			{
+			}
+		}
+
+		for(i = 0; i < count; i++)
+		{
+			status = TwiWait(&requests[i << 1]);
+
+			if(status == TWI_STATUS_DONE)
+			{
+				read++;
+			}
+			else if(status == TWI_STATUS_ADDRESS_NACK)
+			{
+				batch[i]->isOnline = FALSE;
+			}
+		}
+	}
+
+	if(scanner->count > 0)
+	{
+		CheckHealth(scanner->devices[scanner->healthIndex]);
+
+		if(++scanner->healthIndex >= scanner->count)
+		{
+			scanner->healthIndex = 0;
+		}
+	}
+
+	return read;
+}
+
+/***************************************************************************
+*  Function:		BYTE ScannerDiscover(struct TwiMux* mux, BYTE channel)
+*  Description:		Finds the IO Expanders on a bus segment by probing the addresses
+*					0x20-0x27 with address-only transactions. The 8 probes are queued
+*					together and take about 0.2 ms at 400 kHz.
+*  Receives:		struct TwiMux* mux		:	The multiplexer, NULL for the main bus.
+*					BYTE channel			:	The channel of the multiplexer (0-7).
+*  Returns:			Bit n is set when address MCP23017_ADDRESS_FIRST + n responded.
+***************************************************************************/
+BYTE ScannerDiscover(struct TwiMux* mux, BYTE channel)
+{
+	struct TwiRequest requests[MCP23017_ADDRESS_LAST - MCP23017_ADDRESS_FIRST + 1];
+	BYTE found = 0;
+	BYTE i;
+
+	for(i = 0; i < sizeof(requests) / sizeof(requests[0]); i++)
+	{
+		requests[i] = (struct TwiRequest){ .address = MCP23017_ADDRESS_FIRST + i, .mux = mux, .channel = channel,
+										   .flags = TWI_WRITE | TWI_NO_REGISTER, .length = 0,
+										   .statisticsClass = MCP23017_CLASS_BURST, .priority = TWI_PRIORITY_DIAGNOSTIC };
+
+		while(!TwiSubmit(&requests[i]))
+		{
+		}
+	}
+
+	for(i = 0; i < sizeof(requests) / sizeof(requests[0]); i++)
+	{
+		if(TwiWait(&requests[i]) == TWI_STATUS_DONE)
+		{
+			found |= (1 << i);
+		}
+	}
+
+	return found;
+}
@@ -0,0 +1,63 @@
+/*--------------------------------------------------------------------------------------------------------------------------------------------------------
+ * Project: 		MCP23017 TWI Library
+ * Hardware:		Arduino UNO
+ * Micro:			ATMEGA328P
+ * IDE:				Atmel Studio 6.2
+ *
+ * Name:    		scanner.h
+ * Purpose: 		Reads the inputs of many IO Expanders, also behind I2C multiplexers
+ * Date:			19-10-2026
+ * Author:			Marcel van der Ven
+ *
+ * Hardware setup:	Up to 8 MCP23017 per bus segment (A2..A0), segments behind one or more
+ *					TCA9548A compatible multiplexers (0x70-0x77, 8 channels each).
+ *
+ * Note(s):			The devices are sorted by multiplexer and channel once, so a scan selects
+ *					every channel only once. The reads of a batch are queued together and
+ *					the TWI driver executes them back to back (repeated START, no idle bus).
+ *					Per device a BANK0 read of GPIOA/GPIOB is 5 bytes (about 0.12 ms at 400 kHz),
+ *					a channel switch adds 2 bytes (about 0.05 ms). 64 devices on 8 channels take
+ *					about 8 ms per scan (calculated, not measured).
+ *
+ *					Devices which stop responding are marked offline and skipped. Every scan
+ *					also checks the health of one device (round robin): an address probe, for
+ *					online devices followed by the IOCON/IODIR check. A device which comes back
+ *					or lost its configuration (brown-out) is restored from the register shadow.
+ *--------------------------------------------------------------------------------------------------------------------------------------------------------*/
+
+
+#ifndef SCANNER_H_
+#define SCANNER_H_
+
+
+#include "common.h"
+#include "mcp23017.h"
+
+/************************************************************************/
+/* Defines													   */
+/************************************************************************/
+
+/* Number of devices queued at once, each needs two TWI requests on the stack */
+#define SCANNER_BATCH				4
+
+
+/************************************************************************/
+/* Structures												   */
+/************************************************************************/
+struct Scanner
+{
+	struct MCP23017** devices;				/* The IO Expanders, sorted by ScannerInitialize() */
+	BYTE count;								/* Number of devices */
+	BYTE healthIndex;						/* Device checked by the next ScannerRun() */
+};
+
+
+/************************************************************************/
+/* API					                                                */
+/************************************************************************/
+void ScannerInitialize(struct Scanner* scanner, struct MCP23017** devices, BYTE count);
+BYTE ScannerRun(struct Scanner* scanner);
+BYTE ScannerDiscover(struct TwiMux* mux, BYTE channel);
+
+
+#endif /* SCANNER_H_ */
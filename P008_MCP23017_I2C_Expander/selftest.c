@@ -0,0 +1,399 @@
+/*--------------------------------------------------------------------------------------------------------------------------------------------------------
+ * Project:			MCP23017 TWI Library
+ * Hardware:		Arduino UNO
+ * Micro:			ATMEGA328P
+ * IDE:				Atmel Studio 6.2
+ *
+ * Name:    		selftest.c
+ * Purpose: 		On-target randomized consistency check of the MCP23017 driver
+ * Date:			19-10-2026
+ * Version:			1.0
+ * Author:			Marcel van der Ven
+ *
+ *
+ * Note(s):			See selftest.h
+ *--------------------------------------------------------------------------------------------------------------------------------------------------------*/
+
+/************************************************************************/
+/* Includes
+/************************************************************************/
+#include "selftest.h"
+
+#ifdef MCP23017_SELF_TEST
+
+#include <string.h>
+#include "twi.h"
+#include "scanner.h"
+
+
+/************************************************************************/
+/* Variables
+/************************************************************************/
+
+/* Registers which are written randomly, IODIR and IOCON are changed by dedicated steps. The pull-ups */
+/* stay on, so the inputs do not float and the captured port values only change with the pins. */
+static const BYTE writableRegisters[] = { MCP23017_IPOLA, MCP23017_IPOLB, MCP23017_GPINTENA, MCP23017_GPINTENB,
+										  MCP23017_DEFVALA, MCP23017_DEFVALB, MCP23017_INTCONA, MCP23017_INTCONB,
+										  MCP23017_GPIOA, MCP23017_GPIOB, MCP23017_OLATA, MCP23017_OLATB };
+
+static uint16_t randomState;
+
+/* Reference model in BANK0 order */
+static union MCP23017Registers model;
+
+
+/************************************************************************/
+/* Functions
+/************************************************************************/
+
+/***************************************************************************
+*  Function:		BYTE Random()
+*  Description:		16-bit xorshift pseudo random generator, the sequence only
+*					depends on the seed so a failing run can be repeated.
+*  Receives:		Nothing
+*  Returns:			The next random byte.
+***************************************************************************/
+static BYTE Random(void)
+{
+	randomState ^= randomState << 7;
+	randomState ^= randomState >> 9;
+	randomState ^= randomState << 8;
+
+	return (BYTE)randomState;
+}
+
+/***************************************************************************
+*  Function:		ModelWrite(BYTE reg, BYTE value)
+*  Description:		Applies a register write to the reference model.
+*  Receives:		BYTE reg		:	The register address in BANK0.
+*					BYTE value		:	The value written.
+*  Returns:			Nothing
+***************************************************************************/
+static void ModelWrite(BYTE reg, BYTE value)
+{
+	if(reg == MCP23017_IOCONA || reg == MCP23017_IOCONB)
+	{
+		/* IOCONA and IOCONB are the same register */
+		model.iocon[MCP23017_PORTA] = value;
+		model.iocon[MCP23017_PORTB] = value;
+	}
+	else if(reg == MCP23017_GPIOA || reg == MCP23017_GPIOB)
+	{
+		/* A write to the port register goes to the output latch */
+		model.raw[reg + (MCP23017_OLATA - MCP23017_GPIOA)] = value;
+	}
+	else
+	{
+		model.raw[reg] = value;
+	}
+}
+
+/***************************************************************************
+*  Function:		BOOL IsCompared(BYTE reg)
+*  Description:		Checks if a register is part of the comparison, the flag,
+*					capture and port registers follow the pins.
+*  Receives:		BYTE reg		:	The register address in BANK0.
+*  Returns:			TRUE when the register has to match the model.
+***************************************************************************/
+static BOOL IsCompared(BYTE reg)
+{
+	return (reg < MCP23017_INTFA || reg > MCP23017_GPIOB);
+}
+
+/***************************************************************************
+*  Function:		BYTE CompareWithModel(struct MCP23017* device, BOOL dump)
+*  Description:		Compares the shadow, one register read back in the bank in use
+*					and optionally a complete dump with the reference model. The
+*					async dump is compared with the blocking one.
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*					BOOL dump					:	TRUE to dump the complete register map.
+*  Returns:			The number of mismatches.
+***************************************************************************/
+static BYTE CompareWithModel(struct MCP23017* device, BOOL dump)
+{
+	union MCP23017Registers registers;
+	union MCP23017Registers asyncRegisters;
+	struct TwiRequest requests[MCP23017_DUMP_REQUESTS];
+	BYTE mismatches = 0;
+	BYTE reg;
+
+	for(reg = 0; reg < MCP23017_REGISTER_COUNT; reg++)
+	{
+		if(IsCompared(reg) && device->shadow.raw[reg] != model.raw[reg])
+		{
+			mismatches++;
+		}
+	}
+
+	/* Checks the bank translation of the reads */
+	reg = Random() % MCP23017_REGISTER_COUNT;
+	if(IsCompared(reg) && ReadIoExpanderRegister(device, reg) != model.raw[reg])
+	{
+		mismatches++;
+	}
+
+	if(dump)
+	{
+		/* The dump enables sequential operation */
+		ModelWrite(MCP23017_IOCONA, model.iocon[MCP23017_PORTA] & ~MCP23017_SEQOP);
+
+		if(!DumpRegisters(device, &registers))
+		{
+			return mismatches + 1;
+		}
+
+		for(reg = 0; reg < MCP23017_REGISTER_COUNT; reg++)
+		{
+			if(IsCompared(reg) && registers.raw[reg] != model.raw[reg])
+			{
+				mismatches++;
+			}
+		}
+
+		/* The async dump must read the same map */
+		while(!DumpRegistersAsync(device, requests, &asyncRegisters))
+		{
+		}
+
+		if(TwiWait(requests) != TWI_STATUS_DONE || memcmp(asyncRegisters.raw, registers.raw, MCP23017_REGISTER_COUNT) != 0)
+		{
+			mismatches++;
+		}
+	}
+
+	return mismatches;
+}
+
+/***************************************************************************
+*  Function:		BYTE CheckEvents(struct MCP23017* device)
+*  Description:		Waits for the interrupt read of the device and drains the event
+*					log. An event must name the device, may only flag pins with
+*					interrupt-on-change enabled in the model, and its capture must
+*					match INTCAP read back directly (the pins do not change during
+*					the test, so INTCAP keeps the same value). A read which does not
+*					reach INTCAP (for example the flags read twice) fails here.
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*  Returns:			The number of mismatches.
+***************************************************************************/
+static BYTE CheckEvents(struct MCP23017* device)
+{
+	const struct MCP23017Event* event;
+	struct MCP23017Event copy;
+	BYTE mismatches = 0;
+	BYTE count;
+	BYTE port;
+
+	IoExpanderServiceInterrupts();
+	TwiWait(&device->interruptRequest[0]);
+
+	/* An active INT line is read again after every release, one log full per step */
+	for(count = 0; count < MCP23017_EVENT_LOG_SIZE && (event = PeekEvent()) != NULL; count++)
+	{
+		copy = *event;
+		ReleaseEvent();
+		IoExpanderServiceInterrupts();
+
+		if(copy.device != device)
+		{
+			continue;
+		}
+
+		if(copy.address != device->address)
+		{
+			mismatches++;
+		}
+
+		for(port = MCP23017_PORTA; port <= MCP23017_PORTB; port++)
+		{
+			if(copy.intf[port] & ~model.gpinten[port])
+			{
+				mismatches++;
+			}
+
+			if(copy.intf[port] != 0 &&
+			   ReadIoExpanderRegister(device, MCP23017_REGISTER_BANK0(MCP23017_INDEX_INTCAP, port)) != copy.intcap[port])
+			{
+				mismatches++;
+			}
+		}
+	}
+
+	return mismatches;
+}
+
+/***************************************************************************
+*  Function:		uint16_t SelfTestIoExpander(struct MCP23017* device, uint16_t steps, uint16_t seed)
+*  Description:		Runs a random sequence of driver operations and compares the device
+*					and the driver with the reference model after every step. The
+*					configuration of the device is restored afterwards.
+*  Receives:		struct MCP23017* device		:	The initialized IO Expander.
+*					uint16_t steps				:	Number of random operations.
+*					uint16_t seed				:	Start of the random sequence, not 0.
+*  Returns:			The number of mismatches, 0 when the driver is consistent.
+***************************************************************************/
+uint16_t SelfTestIoExpander(struct MCP23017* device, uint16_t steps, uint16_t seed)
+{
+	union MCP23017Registers saved;
+	struct TwiRequest request = { .callback = NULL };
+	struct TwiRequest absent;
+	BYTE absentAddress = 0;
+	BYTE found;
+	BYTE value;
+	BYTE reg;
+	uint16_t mismatches = 0;
+	uint16_t step;
+
+	randomState = (seed != 0) ? seed : 1;
+	SnapshotIoExpander(device, &saved);
+
+	/* Known start: all inputs, BANK0, sequential operation enabled */
+	SwitchBank(device, BANK0);
+	SetSequentialOperation(device, TRUE);
+	WriteIoExpanderRegister(device, MCP23017_IODIRA, 0xFF);
+	WriteIoExpanderRegister(device, MCP23017_IODIRB, 0xFF);
+	WriteIoExpanderRegister(device, MCP23017_GPPUA, 0xFF);
+	WriteIoExpanderRegister(device, MCP23017_GPPUB, 0xFF);
+	model = device->shadow;
+	mismatches += CheckEvents(device);
+
+	/* An address on the same segment without a device, for the NACK injection */
+	found = ScannerDiscover(device->mux, device->channel);
+	for(reg = 0; reg < 8; reg++)
+	{
+		if(!(found & (1 << reg)))
+		{
+			absentAddress = MCP23017_ADDRESS_FIRST + reg;
+			break;
+		}
+	}
+
+	for(step = 0; step < steps; step++)
+	{
+		reg = writableRegisters[Random() % sizeof(writableRegisters)];
+		value = Random();
+
+		switch(Random() % 6)
+		{
+			case 0:
+				WriteIoExpanderRegister(device, reg, value);
+				ModelWrite(reg, value);
+				break;
+
+			case 1:
+				while(!WriteIoExpanderRegisterAsync(device, &request, reg, &value))
+				{
+				}
+				ModelWrite(reg, value);
+				if(TwiWait(&request) != TWI_STATUS_DONE)
+				{
+					mismatches++;
+				}
+				break;
+
+			case 2:
+				SwitchBank(device, (value & 0x01) ? BANK1 : BANK0);
+				ModelWrite(MCP23017_IOCONA, (value & 0x01) ? (model.iocon[MCP23017_PORTA] | MCP23017_BANK)
+														   : (model.iocon[MCP23017_PORTA] & ~MCP23017_BANK));
+				break;
+
+			case 3:
+				SetSequentialOperation(device, value & 0x01);
+				ModelWrite(MCP23017_IOCONA, (value & 0x01) ? (model.iocon[MCP23017_PORTA] & ~MCP23017_SEQOP)
+														   : (model.iocon[MCP23017_PORTA] | MCP23017_SEQOP));
+				break;
+
+			case 4:
+				/* Interrupt read queued in between, as from the INT line */
+				IoExpanderInterrupt(device, value & 0x01);
+				break;
+
+			default:
+				/* Address NACK on the bus, the next transactions must not be affected */
+				if(absentAddress != 0)
+				{
+					absent = (struct TwiRequest){ .address = absentAddress, .mux = device->mux, .channel = device->channel,
+												  .reg = reg, .flags = TWI_WRITE, .length = 1, .buffer = &value,
+												  .statisticsClass = MCP23017_CLASS_BURST };
+					if(TwiTransfer(&absent) != TWI_STATUS_ADDRESS_NACK)
+					{
+						mismatches++;
+					}
+				}
+				break;
+		}
+
+		mismatches += CheckEvents(device);
+		mismatches += CompareWithModel(device, (step & (SELF_TEST_DUMP_INTERVAL - 1)) == 0);
+	}
+
+	if(!RestoreIoExpander(device, &saved))
+	{
+		mismatches++;
+	}
+
+	/* Events of the test configuration are not handed to the application */
+	IoExpanderServiceInterrupts();
+	TwiWait(&device->interruptRequest[0]);
+	while(PeekEvent() != NULL)
+	{
+		ReleaseEvent();
+	}
+
+	return mismatches;
+}
+
+/***************************************************************************
+*  Function:		uint16_t SelfTestMultiplexers(struct MCP23017* first, struct MCP23017* second, uint16_t steps)
+*  Description:		Bench check of two IO Expanders with the same address behind two
+*					different multiplexers. Both get different values in DEFVALA, one
+*					device after the other, and both are read back. When a channel of
+*					the other multiplexer stayed selected, both devices take the write
+*					and the values are the same. DEFVALA is restored afterwards.
+*  Receives:		struct MCP23017* first		:	The IO Expander behind the first multiplexer.
+*					struct MCP23017* second		:	The IO Expander behind the second multiplexer.
+*					uint16_t steps				:	Number of write and read rounds.
+*  Returns:			The number of mismatches, 0 when only one multiplexer was selected at a time.
+***************************************************************************/
+uint16_t SelfTestMultiplexers(struct MCP23017* first, struct MCP23017* second, uint16_t steps)
+{
+	BYTE savedFirst = first->shadow.defval[MCP23017_PORTA];
+	BYTE savedSecond = second->shadow.defval[MCP23017_PORTA];
+	uint16_t mismatches = 0;
+	uint16_t step;
+	BYTE value;
+	BYTE inverted;
+
+	randomState = 0xACE1;
+
+	for(step = 0; step < steps; step++)
+	{
+		value = Random();
+		inverted = ~value;
+
+		WriteIoExpanderRegister(first, MCP23017_DEFVALA, value);
+		WriteIoExpanderRegister(second, MCP23017_DEFVALA, inverted);
+
+		if(ReadIoExpanderRegister(first, MCP23017_DEFVALA) != value)
+		{
+			mismatches++;
+		}
+
+		if(ReadIoExpanderRegister(second, MCP23017_DEFVALA) != inverted)
+		{
+			mismatches++;
+		}
+
+		/* After a request behind the second multiplexer the first one has no channel selected */
+		if(first->mux->selected != 0)
+		{
+			mismatches++;
+		}
+	}
+
+	WriteIoExpanderRegister(first, MCP23017_DEFVALA, savedFirst);
+	WriteIoExpanderRegister(second, MCP23017_DEFVALA, savedSecond);
+
+	return mismatches;
+}
+
+#endif
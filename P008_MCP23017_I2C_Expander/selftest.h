@@ -0,0 +1,56 @@
+/*--------------------------------------------------------------------------------------------------------------------------------------------------------
+ * Project: 		MCP23017 TWI Library
+ * Hardware:		Arduino UNO
+ * Micro:			ATMEGA328P
+ * IDE:				Atmel Studio 6.2
+ *
+ * Name:    		selftest.h
+ * Purpose: 		On-target randomized consistency check of the MCP23017 driver
+ * Date:			19-10-2026
+ * Author:			Marcel van der Ven
+ *
+ * Hardware setup:	A MCP23017 on the bus whose pins may be reconfigured (pull-ups, polarity,
+ *					interrupt-on-change). All pins are kept as inputs, nothing is driven.
+ *
+ * Note(s):			Runs random sequences of register writes (blocking and async), bank switches,
+ *					sequential mode changes, simulated interrupts and transactions to an absent
+ *					address (address NACK) against the real device. A naive reference model (the
+ *					BANK0 register map, updated with the plain datasheet rules) is compared with
+ *					the driver's shadow after every step, with single register reads in the bank
+ *					in use and periodically with a complete register dump. The event log is drained
+ *					after every step: the flags of an event must be enabled in the model and its
+ *					captured values must match INTCAP read back directly.
+ *					A second check alternates between two IO Expanders with the same address behind
+ *					two multiplexers, it needs that setup on the bench and is not called by main.
+ *					Without MCP23017_SELF_TEST nothing of this is compiled.
+ *--------------------------------------------------------------------------------------------------------------------------------------------------------*/
+
+
+#ifndef SELFTEST_H_
+#define SELFTEST_H_
+
+
+#include "common.h"
+#include "mcp23017.h"
+
+/************************************************************************/
+/* Defines													   */
+/************************************************************************/
+
+/* Uncomment to build the self test, it is meant for the bench and not for a release */
+/* #define MCP23017_SELF_TEST */
+
+/* Every n-th step the complete register map is dumped and compared, must be a power of 2 */
+#define SELF_TEST_DUMP_INTERVAL		8
+
+
+/************************************************************************/
+/* API					                                                */
+/************************************************************************/
+#ifdef MCP23017_SELF_TEST
+uint16_t SelfTestIoExpander(struct MCP23017* device, uint16_t steps, uint16_t seed);
+uint16_t SelfTestMultiplexers(struct MCP23017* first, struct MCP23017* second, uint16_t steps);
+#endif
+
+
+#endif /* SELFTEST_H_ */
@@ -0,0 +1,199 @@
+/*--------------------------------------------------------------------------------------------------------------------------------------------------------
+ * Project:			MCP23017 TWI Library
+ * Hardware:		Arduino UNO
+ * Micro:			ATMEGA328P
+ * IDE:				Atmel Studio 6.2
+ *
+ * Name:    		slew.c
+ * Purpose: 		Staggered output changes to limit simultaneous switching
+ * Date:			19-10-2026
+ * Version:			1.0
+ * Author:			Marcel van der Ven
+ *
+ *
+ * Note(s):			See slew.h
+ *--------------------------------------------------------------------------------------------------------------------------------------------------------*/
+
+/************************************************************************/
+/* Includes
+/************************************************************************/
+#include "slew.h"
+#include "timer.h"
+
+
+/************************************************************************/
+/* Functions
+/************************************************************************/
+
+/***************************************************************************
+*  Function:		uint16_t GetOutputs(struct MCP23017* device)
+*  Description:		Returns the output latches of a device from the register shadow.
+*  Receives:		struct MCP23017* device		:	The IO Expander.
+*  Returns:			OLATA in bit 0-7 and OLATB in bit 8-15.
+***************************************************************************/
+static uint16_t GetOutputs(struct MCP23017* device)
+{
+	return device->shadow.olat[MCP23017_PORTA] | ((uint16_t)device->shadow.olat[MCP23017_PORTB] << 8);
+}
+
+/***************************************************************************
+*  Function:		SlewInitialize(struct Slew* slew, struct SlewDevice* devices, BYTE count,
+*								   BYTE groupSize, uint16_t stepTicks)
+*  Description:		Initializes the scheduler, the targets start at the current output
+*					latches so nothing is written until SlewSetOutputs() is called.
+*  Receives:		struct Slew* slew				:	The scheduler.
+*					struct SlewDevice* devices		:	The devices, only the device field has to be set.
+*					BYTE count						:	Number of devices.
+*					BYTE groupSize					:	Pins per device per step (1-16, SLEW_UNLIMITED).
+*					uint16_t stepTicks				:	Time between the steps in timer ticks.
+*  Returns:			Nothing
+***************************************************************************/
+void SlewInitialize(struct Slew* slew, struct SlewDevice* devices, BYTE count, BYTE groupSize, uint16_t stepTicks)
+{
+	BYTE i;
+
+	for(i = 0; i < count; i++)
+	{
+		devices[i].target = GetOutputs(devices[i].device);
+		devices[i].queued = FALSE;
+	}
+
+	slew->devices = devices;
+	slew->count = count;
+	slew->groupSize = (groupSize > 0) ? groupSize : 1;
+	slew->stepTicks = stepTicks;
+	slew->lastStep = TimerGetTicks();
+	slew->writing = FALSE;
+}
+
+/***************************************************************************
+*  Function:		SlewSetOutputs(struct Slew* slew, BYTE index, uint16_t outputs)
+*  Description:		Sets the requested output state of a device, it is reached in
+*					steps by SlewRun(). A new target replaces the previous one, the
+*					pins which already switched are not switched back and forth.
+*  Receives:		struct Slew* slew		:	The scheduler.
+*					BYTE index				:	The device.
+*					uint16_t outputs		:	PORTA in bit 0-7 and PORTB in bit 8-15.
+*  Returns:			Nothing
+***************************************************************************/
+void SlewSetOutputs(struct Slew* slew, BYTE index, uint16_t outputs)
+{
+	slew->devices[index].target = outputs;
+}
+
+/***************************************************************************
+*  Function:		BOOL SlewRun(struct Slew* slew)
+*  Description:		To be called from the main loop, does not block. When the writes
+*					of the previous step are finished and stepTicks have passed, the
+*					next group of changes of every device is queued. The shadow is
+*					updated when a write is finished, a failed write is repeated
+*					with the next step.
+*  Receives:		struct Slew* slew		:	The scheduler.
+*  Returns:			TRUE when all devices reached their target.
+***************************************************************************/
+BOOL SlewRun(struct Slew* slew)
+{
+	uint32_t now = TimerGetTicks();
+	struct SlewDevice* entry;
+	struct TwiRequest* request;
+	uint16_t outputs;
+	uint16_t changes;
+	uint16_t step;
+	BOOL idle = TRUE;
+	BOOL due;
+	BYTE i;
+	BYTE pins;
+
+	if(slew->writing)
+	{
+		for(i = 0; i < slew->count; i++)
+		{
+			entry = &slew->devices[i];
+			request = (entry->requests[0].next != NULL) ? &entry->requests[1] : &entry->requests[0];
+
+			if(entry->queued && request->status == TWI_STATUS_PENDING)
+			{
+				return FALSE;
+			}
+		}
+
+		/* The step is finished, take over the latches which were written */
+		for(i = 0; i < slew->count; i++)
+		{
+			entry = &slew->devices[i];
+			request = (entry->requests[0].next != NULL) ? &entry->requests[1] : &entry->requests[0];
+
+			if(entry->queued && request->status == TWI_STATUS_DONE)
+			{
+				entry->device->shadow.olat[MCP23017_PORTA] = entry->latch[MCP23017_PORTA];
+				entry->device->shadow.olat[MCP23017_PORTB] = entry->latch[MCP23017_PORTB];
+			}
+
+			entry->queued = FALSE;
+		}
+
+		slew->writing = FALSE;
+	}
+
+	due = ((uint32_t)(now - slew->lastStep) >= slew->stepTicks);
+
+	for(i = 0; i < slew->count; i++)
+	{
+		entry = &slew->devices[i];
+		outputs = GetOutputs(entry->device);
+		changes = outputs ^ entry->target;
+
+		if(changes == 0)
+		{
+			continue;
+		}
+
+		idle = FALSE;
+
+		if(!due)
+		{
+			continue;
+		}
+
+		/* The lowest groupSize pins which differ switch in this step */
+		step = 0;
+		for(pins = 0; pins < slew->groupSize && changes != 0; pins++)
+		{
+			step |= changes & (uint16_t)(~changes + 1);
+			changes &= changes - 1;
+		}
+
+		outputs ^= step;
+		entry->latch[MCP23017_PORTA] = (BYTE)outputs;
+		entry->latch[MCP23017_PORTB] = (BYTE)(outputs >> 8);
+
+		/* OLATA and OLATB in one write, both in sequential and in byte mode */
+		request = &entry->requests[0];
+		*request = (struct TwiRequest){ .address = entry->device->address, .mux = entry->device->mux,
+										.channel = entry->device->channel, .reg = MCP23017_OLATA, .flags = TWI_WRITE,
+										.length = 2, .buffer = entry->latch, .statisticsClass = MCP23017_CLASS_OLAT,
+										.priority = TWI_PRIORITY_OUTPUT };
+
+		if(entry->device->bank == BANK1)
+		{
+			request->reg = MCP23017_OLATA_BANK1;
+			request->length = 1;
+			request->next = &entry->requests[1];
+			entry->requests[1] = *request;
+			entry->requests[1].reg = MCP23017_OLATB_BANK1;
+			entry->requests[1].buffer = &entry->latch[MCP23017_PORTB];
+			entry->requests[1].next = NULL;
+		}
+
+		/* With a full queue the device catches up in the next step */
+		entry->queued = TwiSubmit(request);
+		slew->writing |= entry->queued;
+	}
+
+	if(due && !idle)
+	{
+		slew->lastStep = now;
+	}
+
+	return idle;
+}
@@ -0,0 +1,74 @@
+/*--------------------------------------------------------------------------------------------------------------------------------------------------------
+ * Project: 		MCP23017 TWI Library
+ * Hardware:		Arduino UNO
+ * Micro:			ATMEGA328P
+ * IDE:				Atmel Studio 6.2
+ *
+ * Name:    		slew.h
+ * Purpose: 		Staggered output changes to limit simultaneous switching
+ * Date:			19-10-2026
+ * Author:			Marcel van der Ven
+ *
+ * Hardware setup:	Outputs on PORTA and PORTB of one or more MCP23017.
+ *
+ * Note(s):			A new output state is not written at once: every step at most groupSize pins
+ *					of a device change, the steps are stepTicks apart. Per device and step there is
+ *					exactly one transaction which writes OLATA and OLATB (4 bytes, about 0.1 ms at
+ *					400 kHz, BANK1 uses a chain of two 1-byte writes). The writes of all devices of a
+ *					step are queued together, so the devices switch about 0.1 ms after each other.
+ *					A change of n pins on a device costs ceil(n / groupSize) transactions, 16 pins
+ *					with groups of 4 take 4 steps and 4 transactions per device.
+ *					While the scheduler is used it owns OLATA and OLATB of its devices.
+ *--------------------------------------------------------------------------------------------------------------------------------------------------------*/
+
+
+#ifndef SLEW_H_
+#define SLEW_H_
+
+
+#include "common.h"
+#include "mcp23017.h"
+#include "twi.h"
+
+/************************************************************************/
+/* Defines													   */
+/************************************************************************/
+
+/* Group size which does not limit the number of pins per step */
+#define SLEW_UNLIMITED				16
+
+
+/************************************************************************/
+/* Structures												   */
+/************************************************************************/
+
+/* Output state of one IO Expander, bit 0-7 is PORTA and bit 8-15 is PORTB */
+struct SlewDevice
+{
+	struct MCP23017* device;
+	uint16_t target;						/* Requested output state */
+	BYTE latch[2];							/* OLATA and OLATB of the write in progress */
+	struct TwiRequest requests[2];			/* One write, or a chain of two in BANK1 */
+	BOOL queued;							/* The write of the current step is queued */
+};
+
+struct Slew
+{
+	struct SlewDevice* devices;
+	BYTE count;
+	BYTE groupSize;							/* Maximum number of pins per device which change in one step */
+	uint16_t stepTicks;						/* Time between the steps in timer ticks (TIMER_TICKS_PER_US) */
+	uint32_t lastStep;						/* Timer ticks of the last step */
+	BOOL writing;							/* The writes of a step are queued */
+};
+
+
+/************************************************************************/
+/* API					                                                */
+/************************************************************************/
+void SlewInitialize(struct Slew* slew, struct SlewDevice* devices, BYTE count, BYTE groupSize, uint16_t stepTicks);
+void SlewSetOutputs(struct Slew* slew, BYTE index, uint16_t outputs);
+BOOL SlewRun(struct Slew* slew);
+
+
+#endif /* SLEW_H_ */
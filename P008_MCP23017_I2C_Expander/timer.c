@@ -0,0 +1,88 @@
+/*--------------------------------------------------------------------------------------------------------------------------------------------------------
+ * Project:			MCP23017 TWI Library
+ * Hardware:		Arduino UNO
+ * Micro:			ATMEGA328P
+ * IDE:				Atmel Studio 6.2
+ *
+ * Name:    		timer.c
+ * Purpose: 		Free running timestamp counter on Timer1
+ * Date:			19-10-2026
+ * Version:			1.0
+ * Author:			Marcel van der Ven
+ *
+ *
+ * Note(s):			See timer.h
+ *--------------------------------------------------------------------------------------------------------------------------------------------------------*/
+
+/************************************************************************/
+/* Includes
+/************************************************************************/
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include "timer.h"
+
+
+/************************************************************************/
+/* Variables
+/************************************************************************/
+
+/* Upper 16 bits of the timestamp */
+static volatile uint16_t overflows;
+
+
+/************************************************************************/
+/* Functions
+/************************************************************************/
+
+/***************************************************************************
+*  Function:		TimerInitialize()
+*  Description:		Starts Timer1 in normal mode with a prescaler of 8.
+*  Receives:		Nothing
+*  Returns:			Nothing
+***************************************************************************/
+void TimerInitialize(void)
+{
+	TCCR1A = 0;
+	TCCR1B = (1 << CS11);
+	TCNT1 = 0;
+	TIMSK1 = (1 << TOIE1);
+}
+
+/***************************************************************************
+*  Function:		uint32_t TimerGetTicks()
+*  Description:		Reads the 32-bit timestamp, can also be called from interrupts.
+*					An overflow which is not yet handled by the overflow interrupt
+*					is taken into account.
+*  Receives:		Nothing
+*  Returns:			The number of ticks since TimerInitialize().
+***************************************************************************/
+uint32_t TimerGetTicks(void)
+{
+	uint16_t high;
+	uint16_t low;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		high = overflows;
+		low = TCNT1;
+
+		if((TIFR1 & (1 << TOV1)) && low < 0x8000)
+		{
+			high++;
+		}
+	}
+
+	return ((uint32_t)high << 16) | low;
+}
+
+/***************************************************************************
+*  Function:		ISR(TIMER1_OVF_vect)
+*  Description:		Extends the timer to 32 bits.
+*  Receives:		Nothing
+*  Returns:			Nothing
+***************************************************************************/
+ISR(TIMER1_OVF_vect)
+{
+	overflows++;
+}
@@ -0,0 +1,39 @@
+/*--------------------------------------------------------------------------------------------------------------------------------------------------------
+ * Project: 		MCP23017 TWI Library
+ * Hardware:		Arduino UNO
+ * Micro:			ATMEGA328P
+ * IDE:				Atmel Studio 6.2
+ *
+ * Name:    		timer.h
+ * Purpose: 		Free running timestamp counter on Timer1
+ * Date:			19-10-2026
+ * Author:			Marcel van der Ven
+ *
+ * Hardware setup:	
+ *
+ * Note(s):			Timer1 runs at F_CPU / 8 (0.5 us per tick at 16 MHz), the overflow interrupt
+ *					extends the counter to 32 bits (about 35 minutes before it wraps).
+ *					The compare units stay free for periodic tasks (OCR1A is used by bcm.c).
+ *--------------------------------------------------------------------------------------------------------------------------------------------------------*/
+
+
+#ifndef TIMER_H_
+#define TIMER_H_
+
+
+#include "common.h"
+
+/************************************************************************/
+/* Defines													   */
+/************************************************************************/
+#define TIMER_TICKS_PER_US			2
+
+
+/************************************************************************/
+/* API					                                                */
+/************************************************************************/
+void TimerInitialize(void);
+uint32_t TimerGetTicks(void);
+
+
+#endif /* TIMER_H_ */
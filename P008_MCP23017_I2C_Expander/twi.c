@@ -0,0 +1,864 @@
+/*--------------------------------------------------------------------------------------------------------------------------------------------------------
+ * Project:			MCP23017 TWI Library
+ * Hardware:		Arduino UNO
+ * Micro:			ATMEGA328P
+ * IDE:				Atmel Studio 6.2
+ *
+ * Name:    		twi.c
+ * Purpose: 		Interrupt driven TWI (I2C) master with a request queue
+ * Date:			19-10-2026
+ * Version:			1.0
+ * Author:			Marcel van der Ven
+ *
+ *
+ * Note(s):			See twi.h
+ *--------------------------------------------------------------------------------------------------------------------------------------------------------*/
+
+/************************************************************************/
+/* Defines
+/************************************************************************/
+#define F_CPU			16000000UL
+
+/* TWCR values used by the state machine, the interrupt stays enabled */
+#define TWCR_CONTINUE	((1 << TWINT) | (1 << TWEN) | (1 << TWIE))
+#define TWCR_ACK		(TWCR_CONTINUE | (1 << TWEA))
+#define TWCR_START		(TWCR_CONTINUE | (1 << TWSTA))
+#define TWCR_STOP		(TWCR_CONTINUE | (1 << TWSTO))
+#define TWCR_RESTART	(TWCR_CONTINUE | (1 << TWSTO) | (1 << TWSTA))
+
+/* Multiplexer step before the request itself */
+#define MUX_NONE		0			/* The right channel (or none) is selected */
+#define MUX_DESELECT	1			/* Write 0 to the multiplexer of the previous request */
+#define MUX_SELECT		2			/* Write the channel mask to the multiplexer of the request */
+
+
+/************************************************************************/
+/* Includes
+/************************************************************************/
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include <util/twi.h>
+#include <string.h>
+#include "twi.h"
+#include "timer.h"
+
+/* Statistics hooks, selected after twi.h which holds TWI_INSTRUMENTATION */
+#ifdef TWI_INSTRUMENTATION
+#define STATISTICS_START()					(requestStart = TimerGetTicks())
+#define STATISTICS_STOP(request)			RecordStatistics(request)
+#define BLOCKING_START()					uint16_t blockingStart = (uint16_t)TimerGetTicks()
+#define BLOCKING_STOP()						TwiRecordBlocking(blockingStart)
+#else
+#define STATISTICS_START()
+#define STATISTICS_STOP(request)
+#define BLOCKING_START()
+#define BLOCKING_STOP()
+#endif
+
+
+/************************************************************************/
+/* Variables
+/************************************************************************/
+
+/* Requests waiting for the bus per priority, only the TWI interrupt removes entries */
+static struct TwiRequest* volatile queue[TWI_PRIORITIES][TWI_QUEUE_SIZE];
+static volatile BYTE queueHead[TWI_PRIORITIES];
+static volatile BYTE queueTail[TWI_PRIORITIES];
+
+/* Split requests which continue before the queue of their priority */
+static struct TwiRequest* volatile suspended[TWI_PRIORITIES];
+
+/* Request which currently owns the bus, NULL when the bus is idle */
+static struct TwiRequest* volatile current;
+static volatile BYTE dataIndex;
+static volatile BOOL registerSent;
+static volatile BYTE muxStep;
+
+/* The only multiplexer which may have a channel selected, NULL when none has */
+static struct TwiMux* volatile activeMux;
+static volatile BYTE pieceStart;
+
+#ifdef TWI_INSTRUMENTATION
+/* Statistics, only changed by the TWI interrupt */
+static struct TwiStatistics statistics[TWI_STATISTICS_CLASSES];
+static uint32_t requestStart;
+static uint32_t busyTicks;
+static uint32_t statisticsStart;
+static uint16_t latencyHistogram[TWI_PRIORITIES][TWI_LATENCY_BUCKETS];
+
+/* Longest time with interrupts disabled by the driver, in timer ticks */
+static uint16_t longestBlocking;
+#endif
+
+
+/************************************************************************/
+/* Functions
+/************************************************************************/
+
+/***************************************************************************
+*  Function:		StartRequest(struct TwiRequest* request, BYTE control)
+*  Description:		Makes the request the owner of the bus and generates a
+*					(repeated) START condition. A channel selected on another
+*					multiplexer is deselected first, so devices with the same address
+*					behind two multiplexers never answer together. When the request
+*					is behind a multiplexer with another channel selected, the
+*					multiplexer is written next. Only called with interrupts disabled.
+*  Receives:		struct TwiRequest* request	:	The request to start.
+*					BYTE control				:	TWCR value which generates the START.
+*  Returns:			Nothing
+***************************************************************************/
+static void StartRequest(struct TwiRequest* request, BYTE control)
+{
+	current = request;
+	dataIndex = request->offset;
+	pieceStart = request->offset;
+	registerSent = (request->flags & TWI_NO_REGISTER) ? TRUE : FALSE;
+	
+	if(activeMux != NULL && activeMux != request->mux)
+	{
+		muxStep = MUX_DESELECT;
+	}
+	else if(request->mux != NULL && request->mux->selected != (1 << request->channel))
+	{
+		muxStep = MUX_SELECT;
+	}
+	else
+	{
+		muxStep = MUX_NONE;
+	}
+	
+	STATISTICS_START();
+	TWCR = control;
+}
+
+#ifdef TWI_INSTRUMENTATION
+/***************************************************************************
+*  Function:		RecordStatistics(struct TwiRequest* request)
+*  Description:		Adds a finished request to the statistics of its class.
+*					Called from the TWI interrupt.
+*  Receives:		struct TwiRequest* request	:	The finished request.
+*  Returns:			Nothing
+***************************************************************************/
+static void RecordStatistics(struct TwiRequest* request)
+{
+	struct TwiStatistics* entry = &statistics[request->statisticsClass];
+	uint32_t ticks = TimerGetTicks() - requestStart;
+	uint16_t duration = (ticks > 0xFFFF) ? 0xFFFF : (uint16_t)ticks;
+
+	if(entry->count == 0 || duration < entry->minTicks)
+	{
+		entry->minTicks = duration;
+	}
+
+	if(duration > entry->maxTicks)
+	{
+		entry->maxTicks = duration;
+	}
+
+	entry->count++;
+	entry->bytes += (BYTE)(dataIndex - pieceStart);
+	entry->totalTicks += ticks;
+	busyTicks += ticks;
+}
+#endif
+
+#ifdef TWI_INSTRUMENTATION
+/***************************************************************************
+*  Function:		RecordLatency(struct TwiRequest* request)
+*  Description:		Adds the time a request waited in the queue to the latency
+*					histogram of its priority.
+*  Receives:		struct TwiRequest* request	:	The request which gets the bus.
+*  Returns:			Nothing
+***************************************************************************/
+static void RecordLatency(struct TwiRequest* request)
+{
+	uint32_t ticks = TimerGetTicks() - request->submitTicks;
+	uint16_t* bucket = latencyHistogram[request->priority];
+	BYTE bits = 0;
+
+	while(ticks != 0 && bits < TWI_LATENCY_BUCKETS - 1)
+	{
+		ticks >>= 1;
+		bits++;
+	}
+
+	if(bucket[bits] != 0xFFFF)
+	{
+		bucket[bits]++;
+	}
+}
+#endif
+
+/***************************************************************************
+*  Function:		FinishChain(struct TwiRequest* request, BYTE status)
+*  Description:		Hands a request and the rest of its chain back to the owner
+*					with the given status. Called with interrupts disabled.
+*  Receives:		struct TwiRequest* request	:	The request.
+*					BYTE status					:	The final status.
+*  Returns:			Nothing
+***************************************************************************/
+static void FinishChain(struct TwiRequest* request, BYTE status)
+{
+	struct TwiRequest* link;
+
+	/* The rest of a failed chain is not executed */
+	if(status != TWI_STATUS_DONE)
+	{
+		for(link = request->next; link != NULL; link = link->next)
+		{
+			link->status = status;
+		}
+	}
+
+	request->status = status;
+	if(request->callback != NULL)
+	{
+		request->callback(request);
+	}
+}
+
+/***************************************************************************
+*  Function:		StartNext(BYTE control)
+*  Description:		Starts the waiting request with the highest priority, a split
+*					request before the queue of its priority. In the TWI interrupt
+*					(TWCR_RESTART) requests whose deadline passed are finished with
+*					TWI_STATUS_DEADLINE without bus activity. From TwiSubmit() the bus
+*					is idle, so only the new request is waiting and it starts right
+*					away. Only called with interrupts disabled.
+*  Receives:		BYTE control	:	TWCR_START when the bus is idle, TWCR_RESTART when
+*										the current transaction has to be ended.
+*  Returns:			Nothing
+***************************************************************************/
+static void StartNext(BYTE control)
+{
+	struct TwiRequest* request;
+	BYTE priority = TWI_PRIORITIES;
+
+	while(priority > 0)
+	{
+		priority--;
+
+		if(suspended[priority] != NULL)
+		{
+			request = suspended[priority];
+			suspended[priority] = NULL;
+			StartRequest(request, control);
+			return;
+		}
+
+		if(queueHead[priority] == queueTail[priority])
+		{
+			continue;
+		}
+
+		request = queue[priority][queueHead[priority] & (TWI_QUEUE_SIZE - 1)];
+		queueHead[priority]++;
+
+		/* Expired in the TWI interrupt only, so the callbacks are never called from TwiSubmit() */
+		if(control == TWCR_RESTART && request->deadline != 0 && (int32_t)(TimerGetTicks() - request->deadline) >= 0)
+		{
+			/* Marks the bus as busy, a request submitted by the callback is only queued */
+			current = request;
+			FinishChain(request, TWI_STATUS_DEADLINE);
+
+			/* The callback may have submitted a request of a higher priority */
+			priority = TWI_PRIORITIES;
+			continue;
+		}
+
+#ifdef TWI_INSTRUMENTATION
+		RecordLatency(request);
+#endif
+		StartRequest(request, control);
+		return;
+	}
+
+	current = NULL;
+	if(control == TWCR_RESTART)
+	{
+		TWCR = TWCR_STOP;
+	}
+}
+
+/***************************************************************************
+*  Function:		BOOL IsPreempted(struct TwiRequest* request)
+*  Description:		Checks if the current request has to give the bus away, which is
+*					the case for a split-able request when a request of a higher
+*					priority is waiting. At least one byte is transferred per piece.
+*					Called from the TWI interrupt.
+*  Receives:		struct TwiRequest* request	:	The current request.
+*  Returns:			TRUE when the request has to be suspended.
+***************************************************************************/
+static BOOL IsPreempted(struct TwiRequest* request)
+{
+	BYTE priority;
+
+	if(!(request->flags & TWI_SPLITTABLE) || (request->flags & TWI_NO_REGISTER) || request->next != NULL ||
+	   dataIndex == pieceStart)
+	{
+		return FALSE;
+	}
+
+	for(priority = request->priority + 1; priority < TWI_PRIORITIES; priority++)
+	{
+		if(queueHead[priority] != queueTail[priority])
+		{
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+/***************************************************************************
+*  Function:		SuspendRequest()
+*  Description:		Ends the current transaction at a register boundary, the request
+*					continues at the next register when it gets the bus again.
+*					Called from the TWI interrupt.
+*  Receives:		Nothing
+*  Returns:			Nothing
+***************************************************************************/
+static void SuspendRequest(void)
+{
+	struct TwiRequest* request = current;
+
+	STATISTICS_STOP(request);
+
+	request->offset = dataIndex;
+	suspended[request->priority] = request;
+	StartNext(TWCR_RESTART);
+}
+
+/***************************************************************************
+*  Function:		CompleteRequest(BYTE status)
+*  Description:		Finishes the current request and continues with the next request
+*					of its chain (repeated START) or starts the next waiting request,
+*					the STOP and the next START are generated in one go.
+*					Called from the TWI interrupt.
+*  Receives:		BYTE status		:	The final status of the current request.
+*  Returns:			Nothing
+***************************************************************************/
+static void CompleteRequest(BYTE status)
+{
+	struct TwiRequest* request = current;
+
+	STATISTICS_STOP(request);
+
+	/* The state of a multiplexer which did not respond is unknown, it is assumed to have no channel selected */
+	if(muxStep == MUX_DESELECT)
+	{
+		activeMux->selected = 0;
+		activeMux = NULL;
+	}
+	else if(muxStep == MUX_SELECT)
+	{
+		request->mux->selected = 0;
+		activeMux = NULL;
+	}
+
+	if(status == TWI_STATUS_DONE && request->next != NULL)
+	{
+		StartRequest(request->next, TWCR_START);
+	}
+	else
+	{
+		StartNext(TWCR_RESTART);
+	}
+
+	/* The request is handed back to its owner, the next transaction is already on its way */
+	FinishChain(request, status);
+}
+
+/***************************************************************************
+*  Function:		TwiInitialize()
+*  Description:		Sets the bit rate and enables the TWI. Interrupts must be
+*					enabled (sei) before requests can be executed.
+*  Receives:		Nothing
+*  Returns:			Nothing
+***************************************************************************/
+void TwiInitialize(void)
+{
+	/* Prescaler 1: SCL = F_CPU / (16 + 2 * TWBR) */
+	TWSR = 0;
+	TWBR = (BYTE)(((F_CPU / TWI_FREQUENCY) - 16) / 2);
+	TWCR = (1 << TWEN) | (1 << TWIE);
+}
+
+/***************************************************************************
+*  Function:		BOOL TwiSubmit(struct TwiRequest* request)
+*  Description:		Hands a request to the TWI driver, it is queued by its priority
+*					and started directly when the bus is idle, after the STOP of the
+*					previous transaction has been sent. Can be called from the main
+*					loop and from interrupts. Interrupts are only disabled while the
+*					request is put in the queue.
+*  Receives:		struct TwiRequest* request	:	The request (or the first request of a chain),
+*													it must remain valid until the status is no
+*													longer pending.
+*  Returns:			TRUE when the request was accepted, FALSE when the queue of its
+*					priority is full.
+***************************************************************************/
+BOOL TwiSubmit(struct TwiRequest* request)
+{
+	BOOL accepted = TRUE;
+	struct TwiRequest* link;
+	BYTE priority = request->priority;
+
+	/* The rest of the chain is not yet known to the TWI interrupt */
+	for(link = request->next; link != NULL; link = link->next)
+	{
+		link->status = TWI_STATUS_PENDING;
+		link->offset = 0;
+	}
+
+	request->offset = 0;
+#ifdef TWI_INSTRUMENTATION
+	request->submitTicks = TimerGetTicks();
+#endif
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		BLOCKING_START();
+		
+		if((BYTE)(queueTail[priority] - queueHead[priority]) < TWI_QUEUE_SIZE)
+		{
+			request->status = TWI_STATUS_PENDING;
+			queue[priority][queueTail[priority] & (TWI_QUEUE_SIZE - 1)] = request;
+			queueTail[priority]++;
+
+			if(current == NULL)
+			{
+				/* The STOP of the previous transaction may still be on the bus, TWSTO is */
+				/* cleared by the hardware when it is sent (at most one SCL period) */
+				while(TWCR & (1 << TWSTO))
+				{
+				}
+				
+				StartNext(TWCR_START);
+			}
+		}
+		else
+		{
+			accepted = FALSE;
+		}
+		
+		BLOCKING_STOP();
+	}
+
+	/* A rejected chain is not pending */
+	if(!accepted)
+	{
+		for(link = request->next; link != NULL; link = link->next)
+		{
+			link->status = TWI_STATUS_DONE;
+		}
+	}
+
+	return accepted;
+}
+
+/***************************************************************************
+*  Function:		BYTE TwiWait(struct TwiRequest* request)
+*  Description:		Waits until a submitted request (or chain) is finished.
+*					Must not be called from an interrupt.
+*  Receives:		struct TwiRequest* request	:	The submitted request.
+*  Returns:			The final status of the request, for a chain the status of the
+*					last request.
+***************************************************************************/
+BYTE TwiWait(struct TwiRequest* request)
+{
+	while(request->next != NULL)
+	{
+		request = request->next;
+	}
+
+	while(request->status == TWI_STATUS_PENDING)
+	{
+	}
+
+	return request->status;
+}
+
+/***************************************************************************
+*  Function:		BYTE TwiTransfer(struct TwiRequest* request)
+*  Description:		Submits a request and waits until it is finished, if the queue
+*					is full it waits for room. Must not be called from an interrupt.
+*  Receives:		struct TwiRequest* request	:	The request.
+*  Returns:			The final status of the request.
+***************************************************************************/
+BYTE TwiTransfer(struct TwiRequest* request)
+{
+	while(!TwiSubmit(request))
+	{
+	}
+
+	return TwiWait(request);
+}
+
+/***************************************************************************
+*  Function:		BOOL TwiIsIdle()
+*  Description:		Checks if the bus is idle and no requests are waiting.
+*  Receives:		Nothing
+*  Returns:			TRUE when there is no bus activity.
+***************************************************************************/
+BOOL TwiIsIdle(void)
+{
+	return (current == NULL);
+}
+
+/***************************************************************************
+*  Function:		BYTE TwiWriteRegisters(BYTE address, BYTE reg, const BYTE* data, BYTE length, BYTE statisticsClass)
+*  Description:		Writes a number of bytes starting at a register, blocking.
+*  Receives:		BYTE address			:	The 7-bit slave address.
+*					BYTE reg				:	The first register.
+*					const BYTE* data		:	The bytes to write.
+*					BYTE length				:	The number of bytes.
+*					BYTE statisticsClass	:	Statistics class (TWI_INSTRUMENTATION).
+*  Returns:			The final status of the transaction.
+***************************************************************************/
+BYTE TwiWriteRegisters(BYTE address, BYTE reg, const BYTE* data, BYTE length, BYTE statisticsClass)
+{
+	struct TwiRequest request = { .address = address, .reg = reg, .flags = TWI_WRITE, .length = length, .buffer = (BYTE*)data,
+								  .statisticsClass = statisticsClass };
+
+	return TwiTransfer(&request);
+}
+
+/***************************************************************************
+*  Function:		BYTE TwiReadRegisters(BYTE address, BYTE reg, BYTE* data, BYTE length, BYTE statisticsClass)
+*  Description:		Reads a number of bytes starting at a register, blocking.
+*  Receives:		BYTE address			:	The 7-bit slave address.
+*					BYTE reg				:	The first register.
+*					BYTE* data				:	Room for the bytes read.
+*					BYTE length				:	The number of bytes, at least 1.
+*					BYTE statisticsClass	:	Statistics class (TWI_INSTRUMENTATION).
+*  Returns:			The final status of the transaction.
+***************************************************************************/
+BYTE TwiReadRegisters(BYTE address, BYTE reg, BYTE* data, BYTE length, BYTE statisticsClass)
+{
+	struct TwiRequest request = { .address = address, .reg = reg, .flags = TWI_READ, .length = length, .buffer = data,
+								  .statisticsClass = statisticsClass };
+
+	return TwiTransfer(&request);
+}
+
+/***************************************************************************
+*  Function:		TwiWriteRegister(BYTE address, BYTE reg, BYTE value, BYTE statisticsClass)
+*  Description:		Writes a single register, blocking.
+*  Receives:		BYTE address			:	The 7-bit slave address.
+*					BYTE reg				:	The register.
+*					BYTE value				:	The value to write.
+*					BYTE statisticsClass	:	Statistics class (TWI_INSTRUMENTATION).
+*  Returns:			Nothing
+***************************************************************************/
+void TwiWriteRegister(BYTE address, BYTE reg, BYTE value, BYTE statisticsClass)
+{
+	TwiWriteRegisters(address, reg, &value, 1, statisticsClass);
+}
+
+/***************************************************************************
+*  Function:		BYTE TwiReadRegister(BYTE address, BYTE reg, BYTE statisticsClass)
+*  Description:		Reads a single register, blocking.
+*  Receives:		BYTE address			:	The 7-bit slave address.
+*					BYTE reg				:	The register.
+*					BYTE statisticsClass	:	Statistics class (TWI_INSTRUMENTATION).
+*  Returns:			Byte that was read, 0 when the transaction failed.
+***************************************************************************/
+BYTE TwiReadRegister(BYTE address, BYTE reg, BYTE statisticsClass)
+{
+	BYTE value = 0;
+
+	TwiReadRegisters(address, reg, &value, 1, statisticsClass);
+
+	return value;
+}
+
+#ifdef TWI_INSTRUMENTATION
+/***************************************************************************
+*  Function:		TwiGetStatistics(BYTE statisticsClass, struct TwiStatistics* statistics)
+*  Description:		Copies the statistics of a class.
+*  Receives:		BYTE statisticsClass				:	The class.
+*					struct TwiStatistics* result		:	Receives the statistics.
+*  Returns:			Nothing
+***************************************************************************/
+void TwiGetStatistics(BYTE statisticsClass, struct TwiStatistics* result)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		*result = statistics[statisticsClass];
+	}
+
+	result->averageTicks = (result->count > 0) ? (uint16_t)(result->totalTicks / result->count) : 0;
+}
+
+/***************************************************************************
+*  Function:		BYTE TwiGetBusUtilisation()
+*  Description:		Calculates how much of the time the bus was in use since the
+*					statistics were reset.
+*  Receives:		Nothing
+*  Returns:			The bus utilisation in percent.
+***************************************************************************/
+BYTE TwiGetBusUtilisation(void)
+{
+	uint32_t busy;
+	uint32_t elapsed;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		busy = busyTicks;
+		elapsed = TimerGetTicks() - statisticsStart;
+	}
+
+	/* Scale down first so the multiplication does not overflow */
+	elapsed /= 100;
+
+	return (elapsed > 0) ? (BYTE)(busy / elapsed) : 0;
+}
+
+/***************************************************************************
+*  Function:		TwiResetStatistics()
+*  Description:		Clears all statistics and restarts the utilisation measurement.
+*  Receives:		Nothing
+*  Returns:			Nothing
+***************************************************************************/
+void TwiResetStatistics(void)
+{
+	BYTE i;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		for(i = 0; i < TWI_STATISTICS_CLASSES; i++)
+		{
+			statistics[i] = (struct TwiStatistics){ 0 };
+		}
+
+		busyTicks = 0;
+		longestBlocking = 0;
+		statisticsStart = TimerGetTicks();
+		memset(latencyHistogram, 0, sizeof(latencyHistogram));
+	}
+}
+
+/***************************************************************************
+*  Function:		uint32_t TwiGetQueueLatency(BYTE priority, BYTE percentile)
+*  Description:		Returns a percentile of the time requests of a priority waited
+*					in the queue, from the latency histogram. The result is the upper
+*					bound of the histogram bucket, so it is at most twice the real value.
+*  Receives:		BYTE priority		:	The priority (TWI_PRIORITY_...).
+*					BYTE percentile		:	The percentile (1-100), for example 50, 95 or 99.
+*  Returns:			The latency in timer ticks (TIMER_TICKS_PER_US), 0 without requests.
+***************************************************************************/
+uint32_t TwiGetQueueLatency(BYTE priority, BYTE percentile)
+{
+	uint16_t histogram[TWI_LATENCY_BUCKETS];
+	uint32_t total = 0;
+	uint32_t count = 0;
+	BYTE bits;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		memcpy(histogram, latencyHistogram[priority], sizeof(histogram));
+	}
+
+	for(bits = 0; bits < TWI_LATENCY_BUCKETS; bits++)
+	{
+		total += histogram[bits];
+	}
+
+	/* Smallest bucket which holds the requested part of the requests */
+	for(bits = 0; bits < TWI_LATENCY_BUCKETS; bits++)
+	{
+		count += histogram[bits];
+
+		if(total > 0 && count * 100 >= total * percentile)
+		{
+			return (1UL << bits) - 1;
+		}
+	}
+
+	return 0;
+}
+
+/***************************************************************************
+*  Function:		TwiRecordBlocking(uint16_t startTicks)
+*  Description:		Records a section with interrupts disabled, to be called at its end
+*					while interrupts are still disabled. Used by the driver and by the
+*					MCP23017 interrupt servicing.
+*  Receives:		uint16_t startTicks		:	Low 16 bits of TimerGetTicks() at the start.
+*  Returns:			Nothing
+***************************************************************************/
+void TwiRecordBlocking(uint16_t startTicks)
+{
+	uint16_t ticks = (uint16_t)TimerGetTicks() - startTicks;
+	
+	if(ticks > longestBlocking)
+	{
+		longestBlocking = ticks;
+	}
+}
+
+/***************************************************************************
+*  Function:		uint16_t TwiGetLongestBlocking()
+*  Description:		Returns the longest section with interrupts disabled since the
+*					last TwiResetStatistics(): TwiSubmit(), the TWI interrupt with its
+*					callbacks, and the queueing of one interrupt read. The entry and
+*					exit of the interrupt (about 40 cycles) are not included.
+*  Receives:		Nothing
+*  Returns:			The time in timer ticks (TIMER_TICKS_PER_US).
+***************************************************************************/
+uint16_t TwiGetLongestBlocking(void)
+{
+	uint16_t ticks;
+	
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		ticks = longestBlocking;
+	}
+	
+	return ticks;
+}
+#endif
+
+/***************************************************************************
+*  Function:		ISR(TWI_vect)
+*  Description:		TWI state machine, executes the current request byte by byte.
+*					A read first writes the register address and then reads the
+*					data after a repeated START. The multiplexer of the previous
+*					request (when it is another one) is set to 0 and a channel that
+*					has to change is written, each followed by a repeated START.
+*					A split-able burst is suspended between two bytes when a request
+*					of a higher priority waits.
+*  Receives:		Nothing
+*  Returns:			Nothing
+***************************************************************************/
+ISR(TWI_vect)
+{
+	struct TwiRequest* request = current;
+	BLOCKING_START();
+
+	switch(TW_STATUS)
+	{
+		case TW_START:
+		case TW_REP_START:
+			if(muxStep == MUX_DESELECT)
+			{
+				TWDR = (activeMux->address << 1) | TW_WRITE;
+			}
+			else if(muxStep == MUX_SELECT)
+			{
+				TWDR = (request->mux->address << 1) | TW_WRITE;
+			}
+			else if((request->flags & TWI_READ) && registerSent)
+			{
+				TWDR = (request->address << 1) | TW_READ;
+			}
+			else
+			{
+				TWDR = (request->address << 1) | TW_WRITE;
+			}
+			TWCR = TWCR_CONTINUE;
+			break;
+
+		case TW_MT_SLA_ACK:
+			if(muxStep != MUX_NONE)
+			{
+				/* The multiplexer has no register address, the channel mask follows directly */
+				TWDR = (muxStep == MUX_SELECT) ? (1 << request->channel) : 0;
+				TWCR = TWCR_CONTINUE;
+				break;
+			}
+
+			if(!registerSent)
+			{
+				/* A split request continues at the next register */
+				TWDR = request->reg + request->offset;
+				registerSent = TRUE;
+				TWCR = TWCR_CONTINUE;
+				break;
+			}
+			/* Without register address the data follows directly */
+			/* no break */
+
+		case TW_MT_DATA_ACK:
+			if(muxStep == MUX_DESELECT)
+			{
+				/* Previous multiplexer off, select the channel or continue with the request itself */
+				activeMux->selected = 0;
+				activeMux = NULL;
+				muxStep = (request->mux != NULL && request->mux->selected != (1 << request->channel)) ? MUX_SELECT : MUX_NONE;
+				TWCR = TWCR_START;
+			}
+			else if(muxStep == MUX_SELECT)
+			{
+				/* Channel selected, continue with the request itself */
+				request->mux->selected = (1 << request->channel);
+				activeMux = request->mux;
+				muxStep = MUX_NONE;
+				TWCR = TWCR_START;
+			}
+			else if(request->flags & TWI_READ)
+			{
+				/* Register address sent, read the data after a repeated START */
+				TWCR = TWCR_START;
+			}
+			else if(dataIndex < request->length)
+			{
+				if(IsPreempted(request))
+				{
+					SuspendRequest();
+					break;
+				}
+
+				TWDR = request->buffer[dataIndex++];
+				TWCR = TWCR_CONTINUE;
+			}
+			else
+			{
+				CompleteRequest(TWI_STATUS_DONE);
+			}
+			break;
+
+		case TW_MR_SLA_ACK:
+			/* Acknowledge every byte except the last one */
+			TWCR = ((BYTE)(request->length - dataIndex) > 1) ? TWCR_ACK : TWCR_CONTINUE;
+			break;
+
+		case TW_MR_DATA_ACK:
+			/* A preempted read ends its piece by not acknowledging the next byte */
+			request->buffer[dataIndex++] = TWDR;
+			TWCR = (dataIndex < (BYTE)(request->length - 1) && !IsPreempted(request)) ? TWCR_ACK : TWCR_CONTINUE;
+			break;
+
+		case TW_MR_DATA_NACK:
+			request->buffer[dataIndex++] = TWDR;
+			if(dataIndex < request->length)
+			{
+				SuspendRequest();
+			}
+			else
+			{
+				CompleteRequest(TWI_STATUS_DONE);
+			}
+			break;
+
+		case TW_MT_SLA_NACK:
+		case TW_MR_SLA_NACK:
+			CompleteRequest(TWI_STATUS_ADDRESS_NACK);
+			break;
+
+		case TW_MT_DATA_NACK:
+			CompleteRequest(TWI_STATUS_DATA_NACK);
+			break;
+
+		case TW_MT_ARB_LOST:
+			/* Another master won, retry the complete transaction when the bus is free */
+			StartRequest(request, TWCR_START);
+			break;
+
+		default:
+			CompleteRequest(TWI_STATUS_BUS_ERROR);
+			break;
+	}
+	
+	BLOCKING_STOP();
+}
@@ -0,0 +1,172 @@
+/*--------------------------------------------------------------------------------------------------------------------------------------------------------
+ * Project: 		MCP23017 TWI Library
+ * Hardware:		Arduino UNO
+ * Micro:			ATMEGA328P
+ * IDE:				Atmel Studio 6.2
+ *
+ * Name:    		twi.h
+ * Purpose: 		Interrupt driven TWI (I2C) master with a request queue
+ * Date:			19-10-2026
+ * Author:			Marcel van der Ven
+ *
+ * Hardware setup:	SDA on PC4, SCL on PC5 (external pull-ups).
+ *
+ * Note(s):			The TWI interrupt is the single owner of the bus. The main loop and other
+ *					interrupts hand over complete transactions (struct TwiRequest) which are queued
+ *					and executed one after the other, so a transaction can never be interleaved
+ *					with another one.
+ *
+ *					Interrupts are disabled while a request is put in the queue (TwiSubmit) and, on
+ *					an idle bus, started, and for the TWI interrupt with its completion callbacks.
+ *					Callbacks, also of requests whose deadline passed, are always called from the
+ *					TWI interrupt. No section walks a list whose length grows with the number of
+ *					devices: the MCP23017 driver queues one interrupt read per section. Counted
+ *					from the source, not measured yet: TwiSubmit about 150 cycles (10 us at 16 MHz,
+ *					plus up to one SCL period while the STOP of the previous transaction is sent),
+ *					queueing an interrupt read about 350 cycles (22 us), a byte in the TWI interrupt
+ *					about 80 cycles and the completion of an interrupt read, which queues up to two
+ *					reads, about 900 cycles (56 us). With TWI_INSTRUMENTATION the longest section
+ *					is measured on the target with Timer1 (TwiGetLongestBlocking, 0.5 us).
+ *
+ *					Every priority has its own queue. A chain or a normal request keeps the bus until
+ *					it is finished, so an interrupt read waits at most for one transaction; long
+ *					bursts marked TWI_SPLITTABLE (register dumps and restores) give the bus away
+ *					after the byte in progress (about 25 us at 400 kHz) instead of after the burst
+ *					(0.5 ms for a register dump).
+ *--------------------------------------------------------------------------------------------------------------------------------------------------------*/
+
+
+#ifndef TWI_H_
+#define TWI_H_
+
+
+#include <stddef.h>
+#include "common.h"
+
+/************************************************************************/
+/* Defines													   */
+/************************************************************************/
+
+/* Bus speed, the MCP23017 supports 100 kHz, 400 kHz and 1.7 MHz */
+#define TWI_FREQUENCY				400000UL
+
+/* Number of requests per priority that can wait for the bus, must be a power of 2 */
+#define TWI_QUEUE_SIZE				8
+
+/* Priorities, the queue of a higher priority is always served first */
+#define TWI_PRIORITY_DIAGNOSTIC		0		/* Configuration, dumps and health checks (default) */
+#define TWI_PRIORITY_SCAN			1		/* Input scanning */
+#define TWI_PRIORITY_OUTPUT			2		/* Output updates */
+#define TWI_PRIORITY_INTERRUPT		3		/* Interrupt servicing (INTF/INTCAP reads) */
+#define TWI_PRIORITIES				4
+
+/* Uncomment to collect bus statistics, without it the hooks compile to nothing */
+/* #define TWI_INSTRUMENTATION */
+
+/* Number of statistics classes, the MCP23017 driver uses one per register pair and one for bursts */
+#define TWI_STATISTICS_CLASSES		12
+
+/* Queue latency histogram, bucket n counts the latencies of n significant bits (below 2^n ticks) */
+#define TWI_LATENCY_BUCKETS			20
+
+/* Request flags */
+#define TWI_WRITE					0x00	/* Write the buffer to the register(s) */
+#define TWI_READ					0x01	/* Read the register(s) into the buffer */
+#define TWI_NO_REGISTER				0x02	/* No register address, the data directly follows the slave address */
+#define TWI_SPLITTABLE				0x04	/* Auto-incrementing burst, may be split at a register boundary */
+
+/* Request status */
+#define TWI_STATUS_DONE				0x00	/* Finished successfully (or never submitted) */
+#define TWI_STATUS_PENDING			0x01	/* Waiting in the queue or on the bus */
+#define TWI_STATUS_ADDRESS_NACK		0x02	/* No slave acknowledged the address */
+#define TWI_STATUS_DATA_NACK		0x03	/* The slave did not acknowledge a data byte */
+#define TWI_STATUS_BUS_ERROR		0x04	/* Illegal START or STOP condition on the bus */
+#define TWI_STATUS_DEADLINE			0x05	/* The deadline passed before the request got the bus */
+#define TWI_STATUS_INVALID			0x06	/* Rejected before the bus, for example registers outside the map */
+
+
+/************************************************************************/
+/* Structures												   */
+/************************************************************************/
+
+/* I2C multiplexer (TCA9548A and compatibles), a request with a mux is routed through the given channel. */
+/* The TWI interrupt only writes the mux when the selected channel has to change. Only one mux has */
+/* a channel selected at a time: before another mux (or a directly connected slave) is used, 0 is */
+/* written to the previous one, so slaves with the same address on two muxes never answer together. */
+struct TwiMux
+{
+	BYTE address;							/* 7-bit address of the multiplexer (0x70-0x77) */
+	volatile BYTE selected;					/* Selected channel mask, 0 after power-on, owned by the TWI interrupt */
+};
+
+/* A complete register transaction: START, address, register, data and STOP. */
+/* The request and its buffer belong to the TWI driver until the status is no longer pending. */
+/* Requests can be chained with next, the chain is one bus transaction (one START and one STOP) */
+/* and is submitted by submitting the first request. When a request of the chain fails the */
+/* remaining requests get the same status. The callback of a link is called before the next */
+/* link is on the bus, it may still change the register, buffer and length of that link. */
+/* A TWI_SPLITTABLE request (not a chain) is suspended after any byte when a request of a higher */
+/* priority is waiting, it continues later at the next register with a new transaction. */
+struct TwiRequest
+{
+	BYTE address;							/* 7-bit slave address */
+	BYTE reg;								/* Register address which is sent before the data */
+	BYTE flags;								/* TWI_WRITE or TWI_READ, TWI_NO_REGISTER, TWI_SPLITTABLE */
+	BYTE length;							/* Number of data bytes */
+	BYTE* buffer;							/* Data to write or room for the data read */
+	volatile BYTE status;					/* TWI_STATUS_... */
+	BYTE statisticsClass;					/* Only used with TWI_INSTRUMENTATION */
+	struct TwiMux* mux;						/* Multiplexer in front of the slave, NULL when directly connected */
+	BYTE channel;							/* Channel of the multiplexer (0-7) */
+	BYTE priority;							/* TWI_PRIORITY_... */
+	BYTE offset;							/* Bytes transferred before a split, owned by the TWI driver */
+	uint32_t deadline;						/* Latest start in timer ticks (TIMER_TICKS_PER_US) when waiting behind other requests, 0 for none */
+#ifdef TWI_INSTRUMENTATION
+	uint32_t submitTicks;					/* Timer ticks at TwiSubmit(), for the queue latency */
+#endif
+
+	/* Called from the TWI interrupt when the request is finished, may be NULL */
+	void (*callback)(struct TwiRequest* request);
+	
+	/* Next request of a chain, it follows with a repeated START instead of STOP and START */
+	struct TwiRequest* next;
+};
+
+
+/* Bus statistics of one class, the times are in timer ticks (TIMER_TICKS_PER_US) */
+struct TwiStatistics
+{
+	uint16_t count;							/* Number of transactions */
+	uint32_t bytes;							/* Number of data bytes */
+	uint16_t minTicks;						/* Shortest transaction, START up to and including STOP */
+	uint16_t maxTicks;						/* Longest transaction */
+	uint16_t averageTicks;					/* Average transaction time */
+	uint32_t totalTicks;					/* Time the class used the bus */
+};
+
+
+/************************************************************************/
+/* API					                                                */
+/************************************************************************/
+void TwiInitialize(void);
+BOOL TwiSubmit(struct TwiRequest* request);
+BYTE TwiWait(struct TwiRequest* request);
+BYTE TwiTransfer(struct TwiRequest* request);
+BOOL TwiIsIdle(void);
+
+BYTE TwiWriteRegisters(BYTE address, BYTE reg, const BYTE* data, BYTE length, BYTE statisticsClass);
+BYTE TwiReadRegisters(BYTE address, BYTE reg, BYTE* data, BYTE length, BYTE statisticsClass);
+void TwiWriteRegister(BYTE address, BYTE reg, BYTE value, BYTE statisticsClass);
+BYTE TwiReadRegister(BYTE address, BYTE reg, BYTE statisticsClass);
+
+#ifdef TWI_INSTRUMENTATION
+void TwiGetStatistics(BYTE statisticsClass, struct TwiStatistics* statistics);
+BYTE TwiGetBusUtilisation(void);
+void TwiResetStatistics(void);
+uint32_t TwiGetQueueLatency(BYTE priority, BYTE percentile);
+void TwiRecordBlocking(uint16_t startTicks);
+uint16_t TwiGetLongestBlocking(void);
+#endif
+
+
+#endif /* TWI_H_ */